@@ -0,0 +1,136 @@
+// sino-lock-bench: lock/unlock throughput of the THREAD locks against
+// pthread_mutex and pthread_spin, for 1, 2, 4 ... threads
+//
+// usage: sino-lock-bench [max threads] [milliseconds per run] [work]
+// every thread takes the lock in a loop for the run's duration and does
+// work units of arithmetic inside and outside the critical section; the
+// table shows total lock acquisitions per second, fairness (acquisitions of
+// the least lucky thread over those of the luckiest) and the contention
+// counters
+//
+// with more threads than cores the pure spin locks fall apart: waiters burn
+// whole time slices while the holder is descheduled
+
+#include "system/lock.h"
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+class PthreadMutex {
+  pthread_mutex_t _mutex = PTHREAD_MUTEX_INITIALIZER;
+
+public:
+  ~PthreadMutex() { pthread_mutex_destroy(&_mutex); }
+  void lock() { pthread_mutex_lock(&_mutex); }
+  bool try_lock() { return pthread_mutex_trylock(&_mutex) == 0; }
+  void unlock() { pthread_mutex_unlock(&_mutex); }
+  THREAD::LockStats Stats() const { return {}; }
+};
+
+class PthreadSpin {
+  pthread_spinlock_t _lock;
+
+public:
+  PthreadSpin() { pthread_spin_init(&_lock, PTHREAD_PROCESS_PRIVATE); }
+  ~PthreadSpin() { pthread_spin_destroy(&_lock); }
+  void lock() { pthread_spin_lock(&_lock); }
+  bool try_lock() { return pthread_spin_trylock(&_lock) == 0; }
+  void unlock() { pthread_spin_unlock(&_lock); }
+  THREAD::LockStats Stats() const { return {}; }
+};
+
+// keeps the optimizer from dropping the work loop
+volatile uint64_t sink;
+
+inline uint64_t work(uint64_t x, unsigned units) {
+  for (unsigned i = 0; i < units; i++)
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+  return x;
+}
+
+template <class Lock>
+void run(char const *name, unsigned threads, unsigned ms, unsigned units) {
+  Lock lock;
+  uint64_t shared = 0;
+  std::vector<uint64_t> counts(threads);
+  std::vector<std::thread> workers;
+  std::atomic<unsigned> ready{0};
+  std::atomic<bool> go{false};
+  std::atomic<bool> stop{false};
+
+  for (unsigned t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      ready.fetch_add(1);
+      while (!go.load(std::memory_order_acquire))
+        std::this_thread::yield();
+      uint64_t local = t;
+      uint64_t n = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        {
+          std::lock_guard<Lock> guard(lock);
+          shared = work(shared, units);
+        }
+        local = work(local, units);
+        n++;
+      }
+      sink = local;
+      counts[t] = n;
+    });
+  }
+  while (ready.load() != threads)
+    std::this_thread::yield();
+  auto start = std::chrono::steady_clock::now();
+  go.store(true, std::memory_order_release);
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+  stop.store(true, std::memory_order_relaxed);
+  for (auto &w : workers)
+    w.join();
+  double elapsed =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+  sink = shared;
+
+  uint64_t total = 0;
+  for (auto n : counts)
+    total += n;
+  auto least = *std::min_element(counts.begin(), counts.end());
+  auto most = *std::max_element(counts.begin(), counts.end());
+  auto stats = lock.Stats();
+  printf("%-16s %3u %12.0f %8.2f %14llu %14llu %10llu\n", name, threads,
+         total / elapsed, most == 0 ? 0.0 : double(least) / most,
+         static_cast<unsigned long long>(stats.acquisitions),
+         static_cast<unsigned long long>(stats.spins),
+         static_cast<unsigned long long>(stats.parks));
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  unsigned maxThreads =
+      argc > 1 ? std::atoi(argv[1])
+               : std::max(4u, 2 * std::thread::hardware_concurrency());
+  unsigned ms = argc > 2 ? std::atoi(argv[2]) : 500;
+  unsigned units = argc > 3 ? std::atoi(argv[3]) : 8;
+
+  printf("%-16s %3s %12s %8s %14s %14s %10s\n", "lock", "thr", "locks/s",
+         "fair", "acquisitions", "spins", "parks");
+  for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+    run<PthreadMutex>("pthread_mutex", threads, ms, units);
+    run<PthreadSpin>("pthread_spin", threads, ms, units);
+    run<THREAD::SpinLock<true>>("SpinLock", threads, ms, units);
+    run<THREAD::TicketLock<true>>("TicketLock", threads, ms, units);
+    run<THREAD::AdaptiveMutex<true>>("AdaptiveMutex", threads, ms, units);
+    printf("\n");
+  }
+  return 0;
+}
@@ -0,0 +1,166 @@
+// sino-queue-bench: hand-off throughput of the THREAD queues against a
+// std::queue under a std::mutex with two condition variables
+//
+// usage: sino-queue-bench [items] [capacity] [batch]
+// producers push items integers in total through a bounded queue of
+// capacity, consumers pop them with blocking calls; the batch rows move
+// batch items per call; every run checks that the sum arrived intact
+
+#include "system/queue.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// the baseline: the logger's hand-off before it moved to rings
+class MutexQueue {
+  std::mutex _mutex;
+  std::condition_variable _not_empty;
+  std::condition_variable _not_full;
+  std::queue<uint64_t> _queue;
+  std::size_t _capacity;
+
+public:
+  explicit MutexQueue(std::size_t capacity) : _capacity(capacity) {}
+
+  bool Push(uint64_t value) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _not_full.wait(lock, [&] { return _queue.size() < _capacity; });
+    _queue.push(value);
+    lock.unlock();
+    _not_empty.notify_one();
+    return true;
+  }
+
+  bool Pop(uint64_t &out) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _not_empty.wait(lock, [&] { return !_queue.empty(); });
+    out = _queue.front();
+    _queue.pop();
+    lock.unlock();
+    _not_full.notify_one();
+    return true;
+  }
+
+  std::size_t PushBatch(uint64_t const *first, std::size_t count) {
+    std::size_t done = 0;
+    while (done < count) {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _not_full.wait(lock, [&] { return _queue.size() < _capacity; });
+      while (done < count && _queue.size() < _capacity)
+        _queue.push(first[done++]);
+      lock.unlock();
+      _not_empty.notify_all();
+    }
+    return done;
+  }
+
+  std::size_t PopBatch(uint64_t *out, std::size_t count) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _not_empty.wait(lock, [&] { return !_queue.empty(); });
+    std::size_t n = 0;
+    while (n < count && !_queue.empty()) {
+      out[n++] = _queue.front();
+      _queue.pop();
+    }
+    lock.unlock();
+    _not_full.notify_all();
+    return n;
+  }
+};
+
+template <class Queue>
+void run(char const *name, unsigned producers, unsigned consumers,
+         uint64_t items, std::size_t capacity, std::size_t batch) {
+  Queue queue(capacity);
+  std::vector<std::thread> threads;
+  std::vector<uint64_t> sums(consumers);
+  auto perProducer = items / producers;
+  auto total = perProducer * producers;
+  // consumers stop after their share, the last one takes the remainder
+  auto perConsumer = total / consumers;
+
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned p = 0; p < producers; p++) {
+    threads.emplace_back([&, p] {
+      std::vector<uint64_t> buf(batch);
+      uint64_t next = p * perProducer + 1;
+      auto end = next + perProducer;
+      while (next < end) {
+        if (batch == 1) {
+          queue.Push(next++);
+          continue;
+        }
+        std::size_t n = 0;
+        while (n < batch && next < end)
+          buf[n++] = next++;
+        queue.PushBatch(buf.data(), n);
+      }
+    });
+  }
+  for (unsigned c = 0; c < consumers; c++) {
+    threads.emplace_back([&, c] {
+      std::vector<uint64_t> buf(batch);
+      auto want = c + 1 == consumers ? total - perConsumer * c : perConsumer;
+      uint64_t sum = 0;
+      while (want > 0) {
+        if (batch == 1) {
+          uint64_t v = 0;
+          if (!queue.Pop(v))
+            break;
+          sum += v;
+          want--;
+          continue;
+        }
+        auto n = queue.PopBatch(buf.data(), std::min<uint64_t>(batch, want));
+        for (std::size_t i = 0; i < n; i++)
+          sum += buf[i];
+        want -= n;
+      }
+      sums[c] = sum;
+    });
+  }
+  for (auto &t : threads)
+    t.join();
+  double elapsed =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  uint64_t sum = 0;
+  for (auto s : sums)
+    sum += s;
+  bool ok = sum == total * (total + 1) / 2;
+  printf("%-14s %2ux%-2u %6zu %14.0f %s\n", name, producers, consumers, batch,
+         total / elapsed, ok ? "" : "LOST ITEMS");
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  uint64_t items = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4000000;
+  std::size_t capacity = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1024;
+  std::size_t batch = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 32;
+
+  using THREAD::BlockingMpmcQueue;
+  using THREAD::BlockingSpscRing;
+
+  printf("%-14s %5s %6s %14s\n", "queue", "PxC", "batch", "items/s");
+  for (std::size_t b : {std::size_t(1), batch}) {
+    run<MutexQueue>("mutex+queue", 1, 1, items, capacity, b);
+    run<BlockingMpmcQueue<uint64_t>>("MpmcQueue", 1, 1, items, capacity, b);
+    run<BlockingSpscRing<uint64_t>>("SpscRing", 1, 1, items, capacity, b);
+    for (unsigned n : {2u, 4u}) {
+      run<MutexQueue>("mutex+queue", n, n, items, capacity, b);
+      run<BlockingMpmcQueue<uint64_t>>("MpmcQueue", n, n, items, capacity, b);
+    }
+    printf("\n");
+  }
+  return 0;
+}
@@ -0,0 +1,86 @@
+// sino-spawn-bench: cost of starting a helper process from a large parent,
+// fork()+execvp() against PROC::Spawn() and system()
+//
+// usage: sino-spawn-bench [MiB] [spawns] [program]
+// the parent first touches MiB of heap so fork() has page tables to copy,
+// then starts program (default: true) spawns times with each method and
+// waits for it; rows are repeated with the heap grown in steps to MiB
+
+#include "system/spawn.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+int forkExec(char *const argv[]) {
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    exit(1);
+  }
+  if (pid == 0) {
+    execvp(argv[0], argv);
+    _exit(127);
+  }
+  int status;
+  while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+  }
+  return status;
+}
+
+int spawn(char *const argv[]) {
+  return PROC::Spawn(argv, {PROC::Stdio::NUL, PROC::Stdio::PIPE})->Wait();
+}
+
+int shell(char *const argv[]) { return system(argv[0]); }
+
+template <class F>
+void run(char const *name, std::size_t mib, unsigned spawns,
+         char *const argv[], F start) {
+  unsigned failed = 0;
+  auto begin = Clock::now();
+  for (unsigned i = 0; i < spawns; i++)
+    if (start(argv) != 0)
+      failed++;
+  double elapsed = std::chrono::duration<double>(Clock::now() - begin).count();
+  printf("%-12s %8zu %12.1f %s\n", name, mib, elapsed / spawns * 1e6,
+         failed ? "FAILED" : "");
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::size_t mib = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1024;
+  unsigned spawns =
+      argc > 2 ? static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10))
+               : 200;
+  char *program = argc > 3 ? argv[3] : const_cast<char *>("true");
+  char *const args[] = {program, nullptr};
+
+  // resident and written, as in a long-running service
+  std::vector<char *> heap;
+  std::size_t touched = 0;
+
+  printf("%-12s %8s %12s\n", "method", "MiB", "us/spawn");
+  for (std::size_t step : {std::size_t(0), mib / 4, mib}) {
+    for (; touched < step; touched++) {
+      auto chunk = static_cast<char *>(malloc(1 << 20));
+      memset(chunk, 1, 1 << 20);
+      heap.push_back(chunk);
+    }
+    run("fork+exec", touched, spawns, args, forkExec);
+    run("Spawn", touched, spawns, args, spawn);
+    run("system", touched, spawns, args, shell);
+    printf("\n");
+  }
+  for (auto chunk : heap)
+    free(chunk);
+  return 0;
+}
@@ -7,7 +7,9 @@
 #include <unordered_map>
 /* #include <vector> */
 
+#include "system/allocator.h"
 #include "system/file_descriptor.h"
+#include "system/time.h"
 
 using std::chrono_literals::operator""ms;
 
@@ -36,7 +38,12 @@ protected:
   }
 
 protected:
-  std::unordered_map<int, CallBack> _registered{};
+  // map nodes come from the loop thread's slab heap
+  std::unordered_map<int, CallBack, std::hash<int>, std::equal_to<int>,
+                     MEM::SlabAllocator<std::pair<int const, CallBack>>>
+      _registered{};
+  // refreshed once per Wait(), before any callback runs
+  TIME::LoopClock _clock{};
 
 public:
   virtual void Register(
@@ -63,11 +70,15 @@ public:
 
       if (it->second._read_callback == nullptr &&
           it->second._write_callback == nullptr &&
-          it->second._write_callback == nullptr)
+          it->second._error_callback == nullptr)
         _registered.erase(it);
     }
   }
 
+  // time of the current iteration, callbacks read it instead of
+  // calling clock_gettime() themselves
+  TIME::LoopClock const &Clock() const { return _clock; }
+
   // 注册fd与对应event
   // wait infinitely, if some event happens, invoke callback
   virtual void Wait() = 0;
@@ -4,6 +4,8 @@
 #include "network/multiplex.h"
 #include <poll.h>
 
+#include <vector>
+
 namespace IOMUL {
 
 class Poll final : public Multiplex {
@@ -15,22 +17,37 @@ private:
       it.revents = 0;
   }
 
+  // callbacks may register or unregister fds (closing a pipe at end of
+  // file), so the ready entries are copied before any of them runs
+  std::vector<struct pollfd> _ready;
+
+  void invoke(int fd, std::function<void()> CallBack::*callback) {
+    auto found = _registered.find(fd);
+    if (found != _registered.end() && found->second.*callback != nullptr)
+      (found->second.*callback)();
+  }
+
   void InvokeCallback(int ret) {
+    _clock.Refresh();
+    _ready.clear();
     for (auto &it : _fds) {
-      if (ret == 0)
+      if (ret <= 0)
         break;
       if (it.revents > 0) {
         ret--;
-        if (it.revents & POLLIN || it.revents & POLLRDHUP ||
-            it.revents & POLLPRI)
-          _registered[it.fd]._read_callback();
-        if (it.revents & POLLOUT)
-          _registered[it.fd]._write_callback();
-        if (it.revents & POLLERR || it.revents & POLLHUP ||
-            it.revents & POLLNVAL)
-          _registered[it.fd]._error_callback();
+        _ready.push_back(it);
       }
     }
+    for (auto &it : _ready) {
+      if (it.revents & POLLIN || it.revents & POLLRDHUP ||
+          it.revents & POLLPRI)
+        invoke(it.fd, &CallBack::_read_callback);
+      if (it.revents & POLLOUT)
+        invoke(it.fd, &CallBack::_write_callback);
+      if (it.revents & POLLERR || it.revents & POLLHUP ||
+          it.revents & POLLNVAL)
+        invoke(it.fd, &CallBack::_error_callback);
+    }
   }
 
 public:
@@ -52,19 +69,30 @@ public:
       tmp.events |= POLLIN | POLLRDHUP | POLLPRI;
     if (write_callback != nullptr)
       tmp.events |= POLLOUT;
-    if (write_callback != nullptr)
+    if (error_callback != nullptr)
       tmp.events |= POLLERR;
+
+    for (auto &it : _fds) {
+      if (it.fd == fd) {
+        it.events = tmp.events;
+        return;
+      }
+    }
+    _fds.push_back(tmp);
   }
 
   void Unregister(int fd, bool read = false, bool write = false,
                   bool error = false) override {
     Multiplex::Unregister(fd, read, write, error);
 
-    std::vector<struct pollfd>::iterator it;
+    auto it = _fds.begin();
     for (; it != _fds.end(); it++) {
       if (it->fd == fd)
         break;
     }
+    // never registered, nothing to erase or update
+    if (it == _fds.end())
+      return;
     if (_fds.size() != _registered.size())
       _fds.erase(it); // 说明该fd被删除了
     else {
@@ -83,14 +111,8 @@ public:
     InvokeCallback(ret);
   }
   void Wait(std::chrono::milliseconds timeout_ms) override {
-    auto timeout_s =
-        std::chrono::duration_cast<std::chrono::seconds>(
-            timeout_ms);
-    /* struct timeval timeout { */
-    /*   timeout_s.count(), timeout_ms.count() */
-    /* }; */
     PreparePollfd();
-    int ret = poll(_fds.data(), _fds.size(), timeout_s.count());
+    int ret = poll(_fds.data(), _fds.size(), timeout_ms.count());
     InvokeCallback(ret);
   }
 };
@@ -32,6 +32,7 @@ private:
   }
 
   void InvokeCallback(int ret) {
+    _clock.Refresh();
     if (ret == -1)
       throw std::runtime_error(strerror(errno));
     for (int i = 0; i < ret; i++) {
@@ -63,7 +64,7 @@ public:
 
   void Unregister(int fd, bool read = false, bool write = false,
                   bool error = false) override {
-    Multiplex::Unregister(fd, read, write);
+    Multiplex::Unregister(fd, read, write, error);
 
     if (read)
       FD_CLR(fd, read_sets);
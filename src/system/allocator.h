@@ -0,0 +1,497 @@
+#ifndef SINO_ALLOCATOR_H
+#define SINO_ALLOCATOR_H
+
+// aligned_alloc() free() operator new()
+//
+// Allocate/Deallocate: per-thread slab heaps for small objects (<= 1 KiB)
+// every thread allocates from its own 64 KiB slabs, one size class per
+// slab, without locks or atomics; a block freed by another thread is pushed
+// onto its slab's lock-free remote list and taken back by the owner lazily,
+// when it runs out of local blocks; a slab that empties goes back to the
+// system (one emptied by remote frees once the owner next runs short), so
+// long-running processes don't keep fragmented peaks around;
+// the heap of an exited thread is adopted by the next new thread
+//
+// Arena: bump allocator for per-request scratch, freed all at once
+//
+// SlabAllocated<T> (class operator new/delete) and SlabAllocator<T>
+// (std allocator) plug the slab heap into the library's types
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace MEM {
+
+namespace detail {
+
+constexpr std::size_t SLAB_BYTES = 64 << 10;
+constexpr std::size_t MAX_SMALL = 1024;
+constexpr std::size_t MIN_ALIGN = 16;
+
+// 16 byte steps up to 128, then four classes per power of two
+constexpr std::size_t CLASS_SIZES[] = {16,  32,  48,  64,  80,  96,  112,
+                                       128, 160, 192, 224, 256, 320, 384,
+                                       448, 512, 640, 768, 896, 1024};
+constexpr std::size_t CLASSES = sizeof CLASS_SIZES / sizeof CLASS_SIZES[0];
+
+// size class by (size + 15) / 16
+struct ClassTable {
+  uint8_t index[MAX_SMALL / 16 + 1]{};
+
+  constexpr ClassTable() {
+    std::size_t c = 0;
+    for (std::size_t i = 0; i <= MAX_SMALL / 16; i++) {
+      while (CLASS_SIZES[c] < i * 16)
+        c++;
+      index[i] = static_cast<uint8_t>(c);
+    }
+  }
+};
+
+constexpr ClassTable CLASS_TABLE{};
+
+inline std::size_t sizeClass(std::size_t size) {
+  return CLASS_TABLE.index[(size + 15) / 16];
+}
+
+struct Block {
+  Block *next;
+};
+
+struct Heap;
+
+// header at the start of every SLAB_BYTES-aligned slab, blocks follow
+struct alignas(64) Slab {
+  Heap *owner;
+  std::size_t sizeClass;
+  std::size_t blockSize;
+  // owner only
+  Block *free;
+  char *bump;
+  char *end;
+  std::size_t used;
+  Slab *prev;
+  Slab *next;
+  // frees from other threads, on its own line
+  alignas(64) std::atomic<Block *> remote;
+};
+
+inline Slab *slabOf(void *ptr) {
+  return reinterpret_cast<Slab *>(reinterpret_cast<uintptr_t>(ptr) &
+                                  ~(SLAB_BYTES - 1));
+}
+
+struct Heap {
+  // slabs per size class, the head is the one allocations come from
+  Slab *slabs[CLASSES]{};
+  // one emptied slab kept back for the next class that needs one
+  Slab *spare{nullptr};
+  Heap *nextAbandoned{nullptr};
+
+  // take back blocks other threads freed, returns how many
+  static std::size_t collect(Slab *s) {
+    if (s->remote.load(std::memory_order_relaxed) == nullptr)
+      return 0;
+    auto list = s->remote.exchange(nullptr, std::memory_order_acquire);
+    std::size_t n = 0;
+    auto tail = list;
+    for (; tail->next != nullptr; tail = tail->next)
+      n++;
+    tail->next = s->free;
+    s->free = list;
+    s->used -= n + 1;
+    return n + 1;
+  }
+
+  void unlink(Slab *s) {
+    if (s->prev != nullptr)
+      s->prev->next = s->next;
+    else
+      slabs[s->sizeClass] = s->next;
+    if (s->next != nullptr)
+      s->next->prev = s->prev;
+  }
+
+  void pushFront(Slab *s) {
+    s->prev = nullptr;
+    s->next = slabs[s->sizeClass];
+    if (s->next != nullptr)
+      s->next->prev = s;
+    slabs[s->sizeClass] = s;
+  }
+
+  Slab *newSlab(std::size_t c) {
+    Slab *s = spare;
+    spare = nullptr;
+    if (s == nullptr) {
+      void *mem = aligned_alloc(SLAB_BYTES, SLAB_BYTES);
+      if (mem == nullptr)
+        throw std::bad_alloc();
+      s = new (mem) Slab();
+      s->remote.store(nullptr, std::memory_order_relaxed);
+    }
+    s->owner = this;
+    s->sizeClass = c;
+    s->blockSize = CLASS_SIZES[c];
+    s->free = nullptr;
+    s->bump = reinterpret_cast<char *>(s) + sizeof(Slab);
+    s->end = reinterpret_cast<char *>(s) + SLAB_BYTES;
+    s->used = 0;
+    pushFront(s);
+    return s;
+  }
+
+  void releaseSlab(Slab *s) {
+    unlink(s);
+    if (spare == nullptr) {
+      spare = s;
+      return;
+    }
+    s->~Slab();
+    ::free(s);
+  }
+
+  static void *take(Slab *s) {
+    s->used++;
+    if (s->free != nullptr) {
+      auto b = s->free;
+      s->free = b->next;
+      return b;
+    }
+    auto p = s->bump;
+    s->bump += s->blockSize;
+    return p;
+  }
+
+  static bool hasRoom(Slab *s) {
+    return s->free != nullptr ||
+           static_cast<std::size_t>(s->end - s->bump) >= s->blockSize;
+  }
+
+  void *allocate(std::size_t c) {
+    Slab *s = slabs[c];
+    if (s != nullptr && hasRoom(s))
+      return take(s);
+    // the head is exhausted: take back remote frees everywhere, continue in
+    // the first slab with room and give back the others they emptied (with
+    // allocation here and frees elsewhere, only this path sees them empty)
+    Slab *found = nullptr;
+    for (Slab *t = s; t != nullptr;) {
+      auto next = t->next;
+      collect(t);
+      if (found == nullptr && hasRoom(t))
+        found = t;
+      else if (t != s && t->used == 0)
+        releaseSlab(t);
+      t = next;
+    }
+    if (found == nullptr)
+      return take(newSlab(c));
+    if (found != s) {
+      unlink(found);
+      pushFront(found);
+    }
+    return take(found);
+  }
+
+  void deallocate(Slab *s, void *ptr) {
+    auto b = static_cast<Block *>(ptr);
+    b->next = s->free;
+    s->free = b;
+    // keep the slab allocations come from, give back the others once empty
+    if (--s->used == 0 && slabs[s->sizeClass] != s)
+      releaseSlab(s);
+  }
+};
+
+struct Abandoned {
+  std::mutex mutex{};
+  Heap *heaps{nullptr};
+};
+
+// never destroyed, threads may exit after static destructors ran
+inline Abandoned &abandoned() {
+  static Abandoned &a = *new Abandoned();
+  return a;
+}
+
+// the calling thread's heap, parked for adoption when the thread exits
+struct ThreadHeap {
+  Heap *heap;
+
+  constexpr ThreadHeap() : heap(nullptr) {}
+
+  ~ThreadHeap() {
+    if (heap == nullptr)
+      return;
+    auto &a = abandoned();
+    std::lock_guard<std::mutex> lock(a.mutex);
+    heap->nextAbandoned = a.heaps;
+    a.heaps = heap;
+    heap = nullptr;
+  }
+};
+
+inline thread_local ThreadHeap tls_heap;
+
+inline Heap *threadHeapSlow() {
+  auto &a = abandoned();
+  Heap *heap = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(a.mutex);
+    if (a.heaps != nullptr) {
+      heap = a.heaps;
+      a.heaps = heap->nextAbandoned;
+    }
+  }
+  // heaps live as long as the process, their slabs point at them
+  if (heap == nullptr)
+    heap = new Heap();
+  tls_heap.heap = heap;
+  return heap;
+}
+
+inline Heap *threadHeap() {
+  auto heap = tls_heap.heap;
+  return heap != nullptr ? heap : threadHeapSlow();
+}
+
+} // namespace detail
+
+// size bytes, 16-byte aligned; bigger or more strictly aligned requests go
+// to operator new
+inline void *Allocate(std::size_t size,
+                      std::size_t align = detail::MIN_ALIGN) {
+  if (size > detail::MAX_SMALL || align > detail::MIN_ALIGN)
+    return align > __STDCPP_DEFAULT_NEW_ALIGNMENT__
+               ? ::operator new(size, std::align_val_t(align))
+               : ::operator new(size);
+  return detail::threadHeap()->allocate(detail::sizeClass(size));
+}
+
+// size and align as given to Allocate(); any thread may free
+inline void Deallocate(void *ptr, std::size_t size,
+                       std::size_t align = detail::MIN_ALIGN) {
+  if (ptr == nullptr)
+    return;
+  if (size > detail::MAX_SMALL || align > detail::MIN_ALIGN) {
+    if (align > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+      ::operator delete(ptr, std::align_val_t(align));
+    else
+      ::operator delete(ptr);
+    return;
+  }
+  auto slab = detail::slabOf(ptr);
+  auto heap = detail::tls_heap.heap;
+  if (slab->owner == heap) {
+    heap->deallocate(slab, ptr);
+    return;
+  }
+  // lazily returned: the owner picks it up when it runs short
+  auto b = static_cast<detail::Block *>(ptr);
+  auto head = slab->remote.load(std::memory_order_relaxed);
+  do
+    b->next = head;
+  while (!slab->remote.compare_exchange_weak(
+      head, b, std::memory_order_release, std::memory_order_relaxed));
+}
+
+// derive to allocate T from the slab heap: class Conn : public
+// MEM::SlabAllocated<Conn>; new, make_unique and make_shared's control
+// block stay separate (use allocate_shared with SlabAllocator for that)
+template <class T> class SlabAllocated {
+public:
+  static void *operator new(std::size_t size) {
+    return Allocate(size, alignof(T));
+  }
+  static void operator delete(void *ptr, std::size_t size) {
+    Deallocate(ptr, size, alignof(T));
+  }
+};
+
+// std allocator over the slab heap, for node-based containers
+// (map, unordered_map, list) and allocate_shared
+template <class T> struct SlabAllocator {
+  using value_type = T;
+
+  SlabAllocator() = default;
+  template <class U> SlabAllocator(SlabAllocator<U> const &) {}
+
+  T *allocate(std::size_t n) {
+    return static_cast<T *>(Allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *ptr, std::size_t n) {
+    Deallocate(ptr, n * sizeof(T), alignof(T));
+  }
+
+  template <class U> bool operator==(SlabAllocator<U> const &) const {
+    return true;
+  }
+  template <class U> bool operator!=(SlabAllocator<U> const &) const {
+    return false;
+  }
+};
+
+// bump allocator, everything is freed by Reset() or the destructor
+// not thread safe, one per request/connection/loop iteration
+class Arena {
+private:
+  struct Chunk {
+    Chunk *prev;
+    std::size_t size;
+  };
+
+  // destructors of non-trivial objects made with New(), run by Reset()
+  struct Finalizer {
+    void (*destroy)(void *);
+    void *object;
+    Finalizer *next;
+  };
+
+  std::size_t _chunk_size;
+  // heap chunks, newest first; the caller's buffer is not one of them
+  Chunk *_chunks{nullptr};
+  char *_buffer{nullptr};
+  std::size_t _buffer_size{0};
+  char *_ptr{nullptr};
+  char *_end{nullptr};
+  Finalizer *_finalizers{nullptr};
+  std::size_t _allocated{0};
+
+  void *grow(std::size_t size, std::size_t align) {
+    auto bytes = std::max(_chunk_size, sizeof(Chunk) + size + align);
+    auto chunk = static_cast<Chunk *>(::operator new(bytes));
+    chunk->prev = _chunks;
+    chunk->size = bytes;
+    _chunks = chunk;
+    _ptr = reinterpret_cast<char *>(chunk + 1);
+    _end = reinterpret_cast<char *>(chunk) + bytes;
+    return Allocate(size, align);
+  }
+
+  void runFinalizers() {
+    for (auto f = _finalizers; f != nullptr; f = f->next)
+      f->destroy(f->object);
+    _finalizers = nullptr;
+  }
+
+public:
+  // chunkSize: bytes per chunk taken from the heap
+  explicit Arena(std::size_t chunkSize = 16 << 10) : _chunk_size(chunkSize) {}
+
+  // start on the caller's memory (e.g. a stack buffer), which must outlive
+  // the arena; heap chunks only once it is used up
+  Arena(void *buffer, std::size_t size, std::size_t chunkSize = 16 << 10)
+      : _chunk_size(chunkSize), _buffer(static_cast<char *>(buffer)),
+        _buffer_size(size), _ptr(_buffer), _end(_buffer + size) {}
+
+  ~Arena() {
+    runFinalizers();
+    while (_chunks != nullptr) {
+      auto prev = _chunks->prev;
+      ::operator delete(_chunks);
+      _chunks = prev;
+    }
+  }
+
+  Arena(Arena const &) = delete;
+  void operator=(Arena const &) = delete;
+
+  void *Allocate(std::size_t size,
+                 std::size_t align = alignof(std::max_align_t)) {
+    auto p = reinterpret_cast<uintptr_t>(_ptr);
+    auto aligned = (p + align - 1) & ~(uintptr_t{align} - 1);
+    if (_ptr == nullptr ||
+        aligned + size > reinterpret_cast<uintptr_t>(_end))
+      return grow(size, align);
+    _ptr = reinterpret_cast<char *>(aligned + size);
+    _allocated += size;
+    return reinterpret_cast<void *>(aligned);
+  }
+
+  // destroyed by Reset() or the destructor, in reverse order
+  template <class T, class... Args> T *New(Args &&...args) {
+    void *mem = Allocate(sizeof(T), alignof(T));
+    T *obj = new (mem) T(std::forward<Args>(args)...);
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      auto f = static_cast<Finalizer *>(
+          Allocate(sizeof(Finalizer), alignof(Finalizer)));
+      f->destroy = [](void *o) { static_cast<T *>(o)->~T(); };
+      f->object = obj;
+      f->next = _finalizers;
+      _finalizers = f;
+    }
+    return obj;
+  }
+
+  // uninitialised array
+  template <class T> T *NewArray(std::size_t n) {
+    static_assert(std::is_trivially_destructible_v<T>,
+                  "arena arrays are never destroyed");
+    return static_cast<T *>(Allocate(n * sizeof(T), alignof(T)));
+  }
+
+  std::string_view Copy(std::string_view s) {
+    auto p = static_cast<char *>(Allocate(s.size(), 1));
+    memcpy(p, s.data(), s.size());
+    return {p, s.size()};
+  }
+
+  // free everything; the newest chunk is kept for reuse
+  void Reset() {
+    runFinalizers();
+    if (_chunks != nullptr) {
+      while (_chunks->prev != nullptr) {
+        auto prev = _chunks->prev;
+        _chunks->prev = prev->prev;
+        ::operator delete(prev);
+      }
+      _ptr = reinterpret_cast<char *>(_chunks + 1);
+      _end = reinterpret_cast<char *>(_chunks) + _chunks->size;
+    } else {
+      _ptr = _buffer;
+      _end = _buffer + _buffer_size;
+    }
+    _allocated = 0;
+  }
+
+  // bytes handed out since the last Reset()
+  std::size_t Allocated() const { return _allocated; }
+};
+
+// std allocator over an Arena: deallocate() is a no-op, memory comes back
+// with Arena::Reset(); e.g. std::vector<char, MEM::ArenaAllocator<char>>
+template <class T> struct ArenaAllocator {
+  using value_type = T;
+
+  Arena *arena;
+
+  ArenaAllocator(Arena &a) : arena(&a) {}
+  template <class U>
+  ArenaAllocator(ArenaAllocator<U> const &other) : arena(other.arena) {}
+
+  T *allocate(std::size_t n) {
+    return static_cast<T *>(arena->Allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *, std::size_t) {}
+
+  template <class U> bool operator==(ArenaAllocator<U> const &other) const {
+    return arena == other.arena;
+  }
+  template <class U> bool operator!=(ArenaAllocator<U> const &other) const {
+    return arena != other.arena;
+  }
+};
+
+} // namespace MEM
+
+#endif
@@ -0,0 +1,312 @@
+#ifndef SINO_ASYNC_FILE_H
+#define SINO_ASYNC_FILE_H
+
+// preadv() pwritev() preadv2(RWF_NOWAIT)
+// eventfd()
+//
+// file I/O offloaded from an event loop
+// regular files are always "ready" for select()/poll(), so a read from a
+// loop callback blocks the whole loop for the disk latency; OffloadPool
+// runs reads and writes on a bounded set of I/O threads instead and posts
+// each completion to the Completions channel of the loop that asked for it
+//
+// requests on one fd run in submission order (one thread at a time per
+// fd), and adjacent requests of the same kind are merged into one
+// preadv()/pwritev()
+//
+// plain int fds are used on purpose, so both FD wrappers can use it
+
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "general/inc_exception.h"
+
+namespace FILEIO {
+
+// completion channel of one event loop
+// I/O threads Post() callbacks, the loop runs them from Drain() when the
+// eventfd becomes readable
+class Completions {
+private:
+  int _event_fd{-1};
+  std::mutex _mutex{};
+  std::vector<std::function<void()>> _ready{};
+  std::vector<std::function<void()>> _running{};
+
+public:
+  Completions() {
+    _event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_event_fd == -1)
+      throw std::runtime_error(strerror(errno));
+  }
+
+  ~Completions() { close(_event_fd); }
+
+  Completions(Completions const &) = delete;
+  void operator=(Completions const &) = delete;
+
+  int Fd() const { return _event_fd; }
+
+  // loop.Register(fd, read_callback) as IOMUL::Multiplex provides
+  template <class Loop> void Attach(Loop &loop) {
+    loop.Register(_event_fd, [this] { Drain(); });
+  }
+
+  // only the first completion of a batch writes the eventfd
+  void Post(std::function<void()> &&done) {
+    bool wake;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      wake = _ready.empty();
+      _ready.push_back(std::move(done));
+    }
+    if (wake) {
+      uint64_t one = 1;
+      while (write(_event_fd, &one, sizeof one) == -1 && errno == EINTR) {
+      }
+    }
+  }
+
+  // run every posted callback on the calling (loop) thread
+  std::size_t Drain() {
+    uint64_t count;
+    while (read(_event_fd, &count, sizeof count) == -1 && errno == EINTR) {
+    }
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _running.swap(_ready);
+    }
+    auto n = _running.size();
+    for (auto &done : _running)
+      done();
+    _running.clear();
+    return n;
+  }
+};
+
+class OffloadPool {
+public:
+  // bytes transferred, or -errno
+  // a read is short only at end of file
+  using Callback = std::function<void(ssize_t)>;
+
+private:
+  struct Request {
+    bool write;
+    off_t offset;
+    char *buf;
+    std::size_t length;
+    Completions *to;
+    Callback done;
+  };
+
+  // an fd has an entry while it has queued or running requests,
+  // and sits in _ready at most once
+  std::unordered_map<int, std::deque<Request>> _fds{};
+  std::deque<int> _ready{};
+  std::mutex _mutex{};
+  std::condition_variable _cond{};
+  std::size_t _pending{0};
+  std::size_t _max_pending;
+  std::size_t _max_batch;
+  bool _nowait;
+  bool _stop{false};
+  std::vector<std::thread> _workers{};
+
+  bool enqueue(int fd, Request &&request) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (_stop || _pending >= _max_pending)
+        return false;
+      _pending++;
+      auto it = _fds.find(fd);
+      if (it == _fds.end()) {
+        _fds[fd].push_back(std::move(request));
+        _ready.push_back(fd);
+      } else {
+        it->second.push_back(std::move(request));
+        return true;
+      }
+    }
+    _cond.notify_one();
+    return true;
+  }
+
+  static ssize_t transfer(bool write, int fd, struct iovec *iov, int iovcnt,
+                          off_t offset) {
+    ssize_t total = 0;
+    while (iovcnt > 0) {
+      auto res = write ? pwritev(fd, iov, iovcnt, offset + total)
+                       : preadv(fd, iov, iovcnt, offset + total);
+      if (res == -1) {
+        if (errno == EINTR)
+          continue;
+        return -errno;
+      }
+      if (res == 0)
+        break;
+      total += res;
+      auto n = static_cast<std::size_t>(res);
+      while (iovcnt > 0 && n >= iov->iov_len) {
+        n -= iov->iov_len;
+        iov++;
+        iovcnt--;
+      }
+      if (iovcnt > 0) {
+        iov->iov_base = static_cast<char *>(iov->iov_base) + n;
+        iov->iov_len -= n;
+      }
+    }
+    return total;
+  }
+
+  void run() {
+    std::vector<Request> batch;
+    std::vector<struct iovec> iov;
+    while (true) {
+      int fd;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cond.wait(lock, [this] { return _stop || !_ready.empty(); });
+        if (_ready.empty())
+          return;
+        fd = _ready.front();
+        _ready.pop_front();
+        // merge the requests that continue the first one
+        auto &queue = _fds[fd];
+        std::size_t bytes = 0;
+        do {
+          auto &next = queue.front();
+          if (!batch.empty() &&
+              (next.write != batch.back().write ||
+               next.offset !=
+                   batch.back().offset +
+                       static_cast<off_t>(batch.back().length) ||
+               bytes + next.length > _max_batch || batch.size() == IOV_MAX))
+            break;
+          bytes += next.length;
+          batch.push_back(std::move(next));
+          queue.pop_front();
+        } while (!queue.empty());
+      }
+
+      iov.clear();
+      for (auto &r : batch)
+        iov.push_back({r.buf, r.length});
+      auto res = transfer(batch[0].write, fd, iov.data(), iov.size(),
+                          batch[0].offset);
+
+      // split the result between the merged requests
+      ssize_t left = res;
+      for (auto &r : batch) {
+        ssize_t mine = res;
+        if (res >= 0) {
+          mine = std::min<ssize_t>(left, r.length);
+          left -= mine;
+        }
+        r.to->Post([done = std::move(r.done), mine] { done(mine); });
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending -= batch.size();
+        auto it = _fds.find(fd);
+        if (it->second.empty())
+          _fds.erase(it);
+        else
+          _ready.push_back(fd);
+      }
+      batch.clear();
+    }
+  }
+
+public:
+  // threads: I/O threads, maxPending: queued requests before Read()/Write()
+  // refuse new ones, maxBatch: bytes merged into one system call
+  // nowait: try preadv2(RWF_NOWAIT) on the caller first, page cache hits
+  //   then never leave the loop thread
+  explicit OffloadPool(std::size_t threads = 2, std::size_t maxPending = 4096,
+                       std::size_t maxBatch = 1 << 20, bool nowait = true)
+      : _max_pending(maxPending), _max_batch(maxBatch), _nowait(nowait) {
+    for (std::size_t i = 0; i < std::max<std::size_t>(threads, 1); i++)
+      _workers.emplace_back([this] { run(); });
+  }
+
+  // requests already queued still run, their Completions must outlive the
+  // pool
+  ~OffloadPool() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _cond.notify_all();
+    for (auto &t : _workers)
+      t.join();
+  }
+
+  OffloadPool(OffloadPool const &) = delete;
+  void operator=(OffloadPool const &) = delete;
+
+  // buf must stay valid until done runs on to's loop
+  // false if the pool is full (maxPending) or stopping, done is not called
+  bool Read(Completions &to, int fd, off_t offset, char *buf,
+            std::size_t length, Callback done) {
+#ifdef RWF_NOWAIT
+    if (_nowait && length > 0) {
+      bool idle;
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        idle = _fds.find(fd) == _fds.end();
+      }
+      // a queued write to fd must land first, so only try when fd is idle
+      if (idle) {
+        struct iovec iov {
+          buf, length
+        };
+        auto res = preadv2(fd, &iov, 1, offset, RWF_NOWAIT);
+        if (res == static_cast<ssize_t>(length) || res == 0) {
+          to.Post([done = std::move(done), res] { done(res); });
+          return true;
+        }
+        if (res > 0) {
+          // the cached head is done, offload the rest
+          return enqueue(fd, Request{false, offset + res, buf + res,
+                                     length - res, &to,
+                                     [done = std::move(done), res](ssize_t n) {
+                                       done(n < 0 ? n : n + res);
+                                     }});
+        }
+      }
+    }
+#endif
+    return enqueue(fd,
+                   Request{false, offset, buf, length, &to, std::move(done)});
+  }
+
+  // data must stay valid until done runs on to's loop
+  bool Write(Completions &to, int fd, off_t offset, char const *data,
+             std::size_t length, Callback done) {
+    return enqueue(fd, Request{true, offset, const_cast<char *>(data), length,
+                               &to, std::move(done)});
+  }
+
+  std::size_t Pending() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _pending;
+  }
+};
+
+} // namespace FILEIO
+
+#endif
@@ -0,0 +1,338 @@
+#ifndef SINO_EPOCH_H
+#define SINO_EPOCH_H
+
+// membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED) sched_yield()
+//
+// epoch-based reclamation for read-mostly shared data
+//
+// readers pin the current epoch for the length of a lookup (Epoch::Guard):
+// one store to a per-thread slot, no lock, no write to a shared line;
+// writers publish a new version (EpochPtr::Store/Update) and retire the old
+// one, which is freed once every thread that could still see it has
+// unpinned (a grace period: the global epoch moved on twice)
+//
+// the reader side's store/load fence is moved to the writers with
+// membarrier(), where the kernel supports it, so a pin costs a plain store
+//
+// rules: no blocking or unbounded work while pinned (it holds back all
+// reclamation), and Synchronize() never from inside a guard
+
+#include <linux/membarrier.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace THREAD {
+
+class Epoch {
+private:
+  using Deleter = void (*)(void *);
+
+  struct Retired {
+    void *ptr;
+    Deleter deleter;
+  };
+
+  // objects retired during one epoch
+  struct Limbo {
+    uint64_t epoch{0};
+    std::vector<Retired> items{};
+  };
+
+  // per-thread slot, reused by a later thread after this one exits
+  struct alignas(64) Participant {
+    // 0 when not pinned, otherwise (epoch << 1) | 1
+    std::atomic<uint64_t> state{0};
+    uint32_t nesting{0};
+    uint32_t sinceScan{0};
+    // a copy of Global::membarrier, keeps the reader off the shared line
+    bool lightFence{false};
+    // three epochs in flight: current, previous, and the one being freed
+    Limbo limbo[3]{};
+    std::atomic<bool> used{false};
+    Participant *next{nullptr};
+  };
+
+  struct Global {
+    alignas(64) std::atomic<uint64_t> epoch{1};
+    alignas(64) std::atomic<Participant *> head{nullptr};
+    bool membarrier{false};
+    // limbo lists of exited threads
+    std::mutex orphanMutex{};
+    std::vector<Limbo> orphans{};
+
+    Global() {
+#ifndef __SANITIZE_THREAD__
+      // tsan can't see membarrier() ordering, it gets the fence path
+      membarrier =
+          syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED,
+                  0, 0) == 0;
+#endif
+    }
+  };
+
+  // try to advance after this many Retire() calls on one thread
+  static constexpr uint32_t SCAN_EVERY = 64;
+
+  // never destroyed, threads may still exit after static destructors ran
+  static Global &global() {
+    static Global &g = *new Global();
+    return g;
+  }
+
+  // hands the slot and what it still holds back when the thread exits
+  struct Registration {
+    Participant *participant;
+
+    constexpr Registration() : participant(nullptr) {}
+
+    ~Registration() {
+      if (participant == nullptr)
+        return;
+      auto &g = global();
+      {
+        std::lock_guard<std::mutex> lock(g.orphanMutex);
+        for (auto &limbo : participant->limbo)
+          if (!limbo.items.empty())
+            g.orphans.push_back(std::move(limbo));
+      }
+      for (auto &limbo : participant->limbo)
+        limbo = Limbo{};
+      participant->nesting = 0;
+      participant->state.store(0, std::memory_order_release);
+      participant->used.store(false, std::memory_order_release);
+    }
+  };
+
+  static inline thread_local Registration tls_registration;
+
+  static Participant *registerThread() {
+    auto &g = global();
+    Participant *p = g.head.load(std::memory_order_acquire);
+    for (; p != nullptr; p = p->next) {
+      bool expected = false;
+      if (!p->used.load(std::memory_order_relaxed) &&
+          p->used.compare_exchange_strong(expected, true,
+                                          std::memory_order_acquire))
+        break;
+    }
+    if (p == nullptr) {
+      // never freed, the list only grows to the peak thread count
+      p = new Participant();
+      p->used.store(true, std::memory_order_relaxed);
+      auto head = g.head.load(std::memory_order_relaxed);
+      do
+        p->next = head;
+      while (!g.head.compare_exchange_weak(head, p, std::memory_order_release,
+                                           std::memory_order_relaxed));
+    }
+    p->lightFence = g.membarrier;
+    tls_registration.participant = p;
+    return p;
+  }
+
+  static Participant *self() {
+    auto p = tls_registration.participant;
+    return p != nullptr ? p : registerThread();
+  }
+
+  // the writer half of the pin fence: after it, every reader's pin store
+  // is visible or that reader's loads come after our earlier stores
+  static void heavyFence() {
+    if (global().membarrier)
+      syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+    else
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  // move the global epoch on if every pinned thread has seen it
+  static bool tryAdvance() {
+    auto &g = global();
+    auto epoch = g.epoch.load(std::memory_order_acquire);
+    heavyFence();
+    for (auto p = g.head.load(std::memory_order_acquire); p != nullptr;
+         p = p->next) {
+      auto state = p->state.load(std::memory_order_acquire);
+      if ((state & 1) != 0 && (state >> 1) != epoch)
+        return false;
+    }
+    return g.epoch.compare_exchange_strong(epoch, epoch + 1,
+                                           std::memory_order_acq_rel);
+  }
+
+  static void release(Limbo &limbo) {
+    auto items = std::move(limbo.items);
+    limbo.items.clear();
+    for (auto &r : items)
+      r.deleter(r.ptr);
+  }
+
+  // free what was retired at least two epochs ago
+  static void collect(Participant *p) {
+    auto &g = global();
+    auto epoch = g.epoch.load(std::memory_order_acquire);
+    for (auto &limbo : p->limbo)
+      if (!limbo.items.empty() && limbo.epoch + 2 <= epoch)
+        release(limbo);
+    std::unique_lock<std::mutex> lock(g.orphanMutex, std::try_to_lock);
+    if (!lock.owns_lock() || g.orphans.empty())
+      return;
+    std::vector<Limbo> ready;
+    for (auto it = g.orphans.begin(); it != g.orphans.end();) {
+      if (it->epoch + 2 <= epoch) {
+        ready.push_back(std::move(*it));
+        it = g.orphans.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    lock.unlock();
+    for (auto &limbo : ready)
+      release(limbo);
+  }
+
+public:
+  // pins the calling thread while alive, nests
+  class Guard {
+  private:
+    Participant *_p;
+
+  public:
+    Guard() : _p(self()) {
+      if (_p->nesting++ != 0)
+        return;
+      uint64_t state = (global().epoch.load(std::memory_order_relaxed) << 1) | 1;
+      if (_p->lightFence) {
+        _p->state.store(state, std::memory_order_relaxed);
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+      } else {
+        _p->state.exchange(state, std::memory_order_seq_cst);
+      }
+    }
+
+    ~Guard() {
+      if (--_p->nesting == 0)
+        _p->state.store(0, std::memory_order_release);
+    }
+
+    Guard(Guard const &) = delete;
+    void operator=(Guard const &) = delete;
+  };
+
+  static bool Pinned() {
+    auto p = tls_registration.participant;
+    return p != nullptr && p->nesting > 0;
+  }
+
+  // deleter(ptr) once no reader can reach ptr any more
+  // ptr must already be unreachable for new readers (unlinked/replaced)
+  static void Retire(void *ptr, Deleter deleter) {
+    auto p = self();
+    auto epoch = global().epoch.load(std::memory_order_acquire);
+    auto &limbo = p->limbo[epoch % 3];
+    // the bucket last held epoch - 3 or older, past its grace period
+    if (limbo.epoch != epoch) {
+      release(limbo);
+      limbo.epoch = epoch;
+    }
+    limbo.items.push_back({ptr, deleter});
+    if (++p->sinceScan >= SCAN_EVERY) {
+      p->sinceScan = 0;
+      tryAdvance();
+      collect(p);
+    }
+  }
+
+  template <class T> static void Retire(T *ptr) {
+    Retire(const_cast<void *>(static_cast<void const *>(ptr)),
+           [](void *q) { delete static_cast<T *>(q); });
+  }
+
+  // wait for a grace period, then free everything this thread retired
+  // before the call; throws inside a Guard, it would wait for itself
+  static void Synchronize() {
+    if (Pinned())
+      throw std::runtime_error("Epoch::Synchronize() inside a Guard");
+    auto p = self();
+    auto target = global().epoch.load(std::memory_order_acquire) + 2;
+    while (global().epoch.load(std::memory_order_acquire) < target)
+      if (!tryAdvance())
+        sched_yield();
+    collect(p);
+  }
+};
+
+// a pointer readers load inside an Epoch::Guard and writers replace
+//
+//   EpochPtr<Table> table(new Table(...));
+//   table.Read([&](Table const &t) { return t.Find(key); });
+//   table.Update([&](Table &t) { t.Insert(key, value); });  // copy, edit, publish
+template <class T> class EpochPtr {
+private:
+  std::atomic<T const *> _ptr;
+  // serialises Store()s and Update()s, kept off the readers' line
+  alignas(64) std::mutex _writer{};
+
+  // _writer held
+  void publish(T const *fresh) {
+    auto old = _ptr.exchange(fresh, std::memory_order_acq_rel);
+    if (old != nullptr)
+      Epoch::Retire(old);
+  }
+
+public:
+  explicit EpochPtr(T const *initial = nullptr) : _ptr(initial) {}
+
+  // no reader may be left when this is destroyed
+  ~EpochPtr() { delete _ptr.load(std::memory_order_relaxed); }
+
+  EpochPtr(EpochPtr const &) = delete;
+  void operator=(EpochPtr const &) = delete;
+
+  // valid until the caller's Guard ends
+  T const *Load() const { return _ptr.load(std::memory_order_acquire); }
+
+  // f(T const &) under a guard; f must not keep references past the call
+  // the pointer must not be null
+  template <class F> decltype(auto) Read(F &&f) const {
+    Epoch::Guard guard;
+    return std::forward<F>(f)(*Load());
+  }
+
+  // publish fresh, the previous version is freed after a grace period
+  void Store(T const *fresh) {
+    std::lock_guard<std::mutex> lock(_writer);
+    publish(fresh);
+  }
+
+  // copy the current version, let f edit the copy, publish it
+  // no Store() or Update() in between is lost
+  template <class F> void Update(F &&f) {
+    std::lock_guard<std::mutex> lock(_writer);
+    T *fresh;
+    {
+      // cur stays alive while it is copied, whoever retired it
+      Epoch::Guard guard;
+      auto cur = _ptr.load(std::memory_order_acquire);
+      fresh = cur != nullptr ? new T(*cur) : new T();
+    }
+    try {
+      f(*fresh);
+    } catch (...) {
+      delete fresh;
+      throw;
+    }
+    publish(fresh);
+  }
+};
+
+} // namespace THREAD
+
+#endif
@@ -0,0 +1,289 @@
+#ifndef SINO_FILE_CACHE_H
+#define SINO_FILE_CACHE_H
+
+// open() fstat() stat() close()
+// inotify_init1() inotify_add_watch() inotify_rm_watch()
+//
+// bounded LRU cache from path to an open fd plus its stat, for files served
+// over and over; a hit costs a hash lookup instead of open/fstat/close
+//
+// entries are invalidated by inotify: the file itself is watched for
+// changes (IN_ATTRIB also covers a link count drop, i.e. unlink or rename
+// over it), its directory for names appearing or disappearing (a new file
+// renamed over the path); the loop services the inotify fd, see Attach()
+// the directory is watched before open(), so a rename over the path after
+// that is always reported; the file watch is checked against the inode
+// actually opened, a file replaced in between is served but not cached
+//
+// handles are shared_ptr, an evicted or invalidated entry closes its fd
+// once the last request using it lets go
+// not thread safe, belongs to one loop (handles may move between threads)
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "general/inc_exception.h"
+
+namespace FILEIO {
+
+class FileCache {
+public:
+  struct File {
+    std::string path;
+    int fd;
+    struct stat stat;
+
+    File(std::string const &p, int f, struct stat const &st)
+        : path(p), fd(f), stat(st) {}
+    ~File() { close(fd); }
+
+    File(File const &) = delete;
+    void operator=(File const &) = delete;
+  };
+  using Handle = std::shared_ptr<File const>;
+
+private:
+  static constexpr uint32_t FILE_EVENTS = IN_MODIFY | IN_ATTRIB |
+                                          IN_CLOSE_WRITE | IN_DELETE_SELF |
+                                          IN_MOVE_SELF;
+  static constexpr uint32_t DIR_EVENTS = IN_CREATE | IN_DELETE |
+                                         IN_MOVED_FROM | IN_MOVED_TO |
+                                         IN_DELETE_SELF | IN_MOVE_SELF;
+
+  struct Entry {
+    Handle file;
+    int file_wd;
+    int dir_wd;
+  };
+  using Lru = std::list<Entry>;
+
+  struct Watch {
+    // watched file: the cached paths of that inode (hard links share one wd)
+    // watched directory: the prefix of each cached path in it, one per entry
+    // (different spellings of one directory share one wd)
+    std::vector<std::string> paths;
+    bool directory;
+    std::size_t refs;
+  };
+
+  int _inotify_fd{-1};
+  std::size_t _capacity;
+  // most recently used first
+  Lru _lru{};
+  std::unordered_map<std::string, Lru::iterator> _entries{};
+  std::unordered_map<int, Watch> _watches{};
+  std::unordered_map<std::string, int> _dir_wds{};
+
+  // path up to and including its last '/', empty for a bare name;
+  // prefix + the name in a directory event is the cached key again
+  static std::string prefixOf(std::string const &path) {
+    auto slash = path.rfind('/');
+    return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+  }
+
+  int addWatch(std::string const &path, uint32_t mask) {
+    int wd = inotify_add_watch(_inotify_fd, path.c_str(), mask);
+    if (wd == -1)
+      throw std::runtime_error(path + ": " + strerror(errno));
+    return wd;
+  }
+
+  void release(int wd, std::string const &path) {
+    auto it = _watches.find(wd);
+    if (it == _watches.end())
+      return;
+    auto &watch = it->second;
+    auto key = watch.directory ? prefixOf(path) : path;
+    auto p = std::find(watch.paths.begin(), watch.paths.end(), key);
+    if (p != watch.paths.end())
+      watch.paths.erase(p);
+    if (watch.directory &&
+        std::find(watch.paths.begin(), watch.paths.end(), key) == watch.paths.end())
+      _dir_wds.erase(key);
+    if (--watch.refs > 0)
+      return;
+    inotify_rm_watch(_inotify_fd, wd);
+    _watches.erase(it);
+  }
+
+  void erase(std::unordered_map<std::string, Lru::iterator>::iterator it) {
+    auto entry = it->second;
+    auto path = it->first;
+    _entries.erase(it);
+    release(entry->file_wd, path);
+    release(entry->dir_wd, path);
+    _lru.erase(entry);
+  }
+
+public:
+  explicit FileCache(std::size_t capacity = 1024)
+      : _capacity(std::max<std::size_t>(capacity, 1)) {
+    _inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_inotify_fd == -1)
+      throw std::runtime_error(strerror(errno));
+  }
+
+  ~FileCache() {
+    _lru.clear();
+    close(_inotify_fd);
+  }
+
+  FileCache(FileCache const &) = delete;
+  void operator=(FileCache const &) = delete;
+
+  int Fd() const { return _inotify_fd; }
+
+  // loop.Register(fd, read_callback) as IOMUL::Multiplex provides
+  template <class Loop> void Attach(Loop &loop) {
+    loop.Register(_inotify_fd, [this] { Drain(); });
+  }
+
+  std::size_t Size() const { return _entries.size(); }
+
+  // cached handle, or open + fstat + watch on a miss
+  // throw runtime_error if the file can't be opened
+  Handle Open(std::string const &path) {
+    auto it = _entries.find(path);
+    if (it != _entries.end()) {
+      _lru.splice(_lru.begin(), _lru, it->second);
+      return it->second->file;
+    }
+
+    // the directory first, a rename over path from here on is reported
+    auto prefix = prefixOf(path);
+    int dir_wd;
+    auto dit = _dir_wds.find(prefix);
+    if (dit != _dir_wds.end()) {
+      dir_wd = dit->second;
+    } else {
+      dir_wd = inotify_add_watch(_inotify_fd, prefix.empty() ? "." : prefix.c_str(),
+                                 DIR_EVENTS | IN_ONLYDIR);
+      if (dir_wd == -1)
+        throw std::runtime_error(path + ": " + strerror(errno));
+      _dir_wds[prefix] = dir_wd;
+      _watches[dir_wd].directory = true;
+    }
+    auto &dw = _watches[dir_wd];
+    dw.paths.push_back(prefix);
+    dw.refs++;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st {};
+    if (fd == -1 || fstat(fd, &st) == -1) {
+      int err = errno;
+      if (fd != -1)
+        close(fd);
+      release(dir_wd, path);
+      throw std::runtime_error(path + ": " + strerror(err));
+    }
+    auto file = std::make_shared<File const>(path, fd, st);
+
+    int file_wd;
+    try {
+      file_wd = addWatch(path, FILE_EVENTS);
+    } catch (...) {
+      release(dir_wd, path);
+      throw;
+    }
+    auto &fw = _watches[file_wd];
+    fw.directory = false;
+    fw.refs++;
+    fw.paths.push_back(path);
+
+    // the watch follows the name: if it was replaced since open(), the
+    // watch is on the new file and nothing would invalidate this entry
+    struct stat now {};
+    if (stat(path.c_str(), &now) == -1 || now.st_dev != st.st_dev ||
+        now.st_ino != st.st_ino) {
+      release(file_wd, path);
+      release(dir_wd, path);
+      return file;
+    }
+
+    _lru.push_front(Entry{file, file_wd, dir_wd});
+    _entries[path] = _lru.begin();
+    while (_entries.size() > _capacity)
+      erase(_entries.find(_lru.back().file->path));
+    return file;
+  }
+
+  // drop path now, a handle already given out stays usable
+  void Invalidate(std::string const &path) {
+    auto it = _entries.find(path);
+    if (it != _entries.end())
+      erase(it);
+  }
+
+  void Clear() {
+    while (!_lru.empty())
+      erase(_entries.find(_lru.back().file->path));
+  }
+
+  // read pending inotify events and drop the entries they touch,
+  // returns the number of events
+  std::size_t Drain() {
+    alignas(struct inotify_event) char buf[16384];
+    std::size_t count = 0;
+    while (true) {
+      auto n = read(_inotify_fd, buf, sizeof buf);
+      if (n == -1) {
+        if (errno == EINTR)
+          continue;
+        if (errno == EAGAIN)
+          break;
+        throw std::runtime_error(strerror(errno));
+      }
+      for (char *p = buf; p < buf + n;) {
+        auto event = reinterpret_cast<struct inotify_event *>(p);
+        p += sizeof(struct inotify_event) + event->len;
+        count++;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+          // events were lost, nothing cached can be trusted
+          Clear();
+          continue;
+        }
+        auto it = _watches.find(event->wd);
+        if (it == _watches.end())
+          continue;
+        if (!it->second.directory) {
+          // Invalidate() may drop the watch, copy the paths first
+          auto paths = it->second.paths;
+          for (auto &path : paths)
+            Invalidate(path);
+        } else if (event->len > 0) {
+          // once per spelling of the directory, Invalidate() may drop the
+          // watch, so the prefixes are copied first
+          auto prefixes = it->second.paths;
+          std::sort(prefixes.begin(), prefixes.end());
+          prefixes.erase(std::unique(prefixes.begin(), prefixes.end()),
+                         prefixes.end());
+          for (auto &prefix : prefixes)
+            Invalidate(prefix + event->name);
+        } else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+          // the directory itself moved or vanished, so did every path in it
+          std::vector<std::string> paths;
+          for (auto &entry : _lru)
+            if (entry.dir_wd == event->wd)
+              paths.push_back(entry.file->path);
+          for (auto &path : paths)
+            Invalidate(path);
+        }
+      }
+    }
+    return count;
+  }
+};
+
+} // namespace FILEIO
+
+#endif
@@ -17,11 +17,13 @@
 #include <sys/socket.h>
 
 #include "general/inc_exception.h"
+// per-thread slab heap, every accepted connection allocates one FileDescriptor
+#include "system/allocator.h"
 
 // DON'T ACCESS THIS NAMESPACE DIRECTLY
 // YOU CAN'T INSURE FILE DESCRIPTOR IS ALIVE
 namespace FD {
-    class FileDescriptor final {
+    class FileDescriptor final : public MEM::SlabAllocated<FileDescriptor> {
     private:
 
 		class Type {
@@ -69,11 +71,11 @@ namespace FD {
 				_type = Type::SYMLINK;
 			} else if (S_ISSOCK(_stat.st_mode)) {
 				_type = Type::SOCKET;
-			} else if (S_TYPEISMQ(_stat)) {
+			} else if (S_TYPEISMQ(&_stat)) {
 				_type = Type::MSGQUEUE;
-			} else if (S_TYPEISSEM(_stat)) {
+			} else if (S_TYPEISSEM(&_stat)) {
 				_type = Type::SEMOPHORE;
-			} else if (S_TYPEISSHM(_stat)) {
+			} else if (S_TYPEISSHM(&_stat)) {
 				_type = Type::SHAREMEM;
 			}
 		}
@@ -0,0 +1,369 @@
+#ifndef SINO_FUTEX_H
+#define SINO_FUTEX_H
+
+// futex(FUTEX_WAIT_PRIVATE) futex(FUTEX_WAKE_PRIVATE)
+//
+// the kernel side of blocking: a thread sleeps on a 32-bit word only while
+// it still holds the value it expects, so a wake between checking the word
+// and going to sleep is never lost
+//
+// on top of it, without a mutex: Event, AutoResetEvent, Semaphore, Latch,
+// Barrier; signalling nobody waits for and waiting for what is already
+// signalled stay in user space, the kernel is only entered to sleep and to
+// wake a sleeper
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <ctime>
+
+namespace THREAD {
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) &&
+                  std::atomic<uint32_t>::is_always_lock_free,
+              "futex needs a plain 32-bit atomic word");
+
+namespace detail {
+
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#endif
+}
+
+// PAUSE rounds a waiter spins before it sleeps; none on a single CPU,
+// where the thread it waits for can't run while it spins
+inline int spinRounds() {
+  static int const rounds = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? 128 : 0;
+  return rounds;
+}
+
+// what is left of a deadline as a relative futex timeout, false if passed
+inline bool remaining(std::chrono::steady_clock::time_point deadline,
+                      struct timespec &ts) {
+  auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  deadline - std::chrono::steady_clock::now())
+                  .count();
+  if (left <= 0)
+    return false;
+  ts.tv_sec = static_cast<time_t>(left / 1000000000);
+  ts.tv_nsec = static_cast<long>(left % 1000000000);
+  return true;
+}
+
+} // namespace detail
+
+inline uint32_t *futexWord(std::atomic<uint32_t> &word) {
+  return reinterpret_cast<uint32_t *>(&word);
+}
+
+// sleep while word == expected, or until woken (spuriously too)
+// false if timeout (relative) expired
+inline bool FutexWait(std::atomic<uint32_t> &word, uint32_t expected,
+                      struct timespec const *timeout = nullptr) {
+  auto res = syscall(SYS_futex, futexWord(word), FUTEX_WAIT_PRIVATE, expected,
+                     timeout, nullptr, 0);
+  return !(res == -1 && errno == ETIMEDOUT);
+}
+
+template <class Rep, class Period>
+inline bool FutexWait(std::atomic<uint32_t> &word, uint32_t expected,
+                      std::chrono::duration<Rep, Period> timeout) {
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout);
+  if (ns.count() <= 0)
+    return false;
+  struct timespec ts {
+    static_cast<time_t>(ns.count() / 1000000000),
+        static_cast<long>(ns.count() % 1000000000)
+  };
+  return FutexWait(word, expected, &ts);
+}
+
+// wake up to count threads sleeping on word, returns how many woke
+inline int FutexWake(std::atomic<uint32_t> &word, int count = 1) {
+  auto res = syscall(SYS_futex, futexWord(word), FUTEX_WAKE_PRIVATE, count,
+                     nullptr, nullptr, 0);
+  return res == -1 ? 0 : static_cast<int>(res);
+}
+
+inline int FutexWakeAll(std::atomic<uint32_t> &word) {
+  return FutexWake(word, INT_MAX);
+}
+
+// manual-reset event: Set() releases every waiter and stays set until
+// Reset(); one-shot when never reset
+class Event {
+private:
+  static constexpr uint32_t UNSET = 0, SET = 1, WAITING = 2;
+  std::atomic<uint32_t> _state;
+
+  // UNSET -> WAITING, false if it was set meanwhile
+  bool announce() {
+    auto s = _state.load(std::memory_order_acquire);
+    while (s == UNSET &&
+           !_state.compare_exchange_weak(s, WAITING, std::memory_order_acquire))
+      ;
+    return s != SET;
+  }
+
+public:
+  explicit Event(bool set = false) : _state(set ? SET : UNSET) {}
+  Event(Event const &) = delete;
+  void operator=(Event const &) = delete;
+
+  void Set() {
+    if (_state.load(std::memory_order_relaxed) == SET)
+      return;
+    // only a sleeper announced in the state costs a syscall
+    if (_state.exchange(SET, std::memory_order_release) == WAITING)
+      FutexWakeAll(_state);
+  }
+
+  void Reset() {
+    uint32_t expected = SET;
+    _state.compare_exchange_strong(expected, UNSET, std::memory_order_relaxed);
+  }
+
+  bool IsSet() const { return _state.load(std::memory_order_acquire) == SET; }
+
+  void Wait() {
+    for (int i = 0, n = detail::spinRounds(); i < n; i++) {
+      if (IsSet())
+        return;
+      detail::CpuRelax();
+    }
+    while (announce())
+      FutexWait(_state, WAITING);
+  }
+
+  // false on timeout
+  template <class Rep, class Period>
+  bool WaitFor(std::chrono::duration<Rep, Period> timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    struct timespec ts;
+    while (announce()) {
+      if (!detail::remaining(deadline, ts))
+        return false;
+      FutexWait(_state, WAITING, &ts);
+    }
+    return true;
+  }
+};
+
+// auto-reset event: Set() releases one waiter, or the next Wait() if
+// nobody waits; sets while already set collapse into one
+class AutoResetEvent {
+private:
+  std::atomic<uint32_t> _signaled;
+  std::atomic<uint32_t> _waiters{0};
+
+  bool consume() {
+    uint32_t expected = 1;
+    return _signaled.load(std::memory_order_seq_cst) == 1 &&
+           _signaled.compare_exchange_strong(expected, 0,
+                                             std::memory_order_acquire);
+  }
+
+  // sleep until signalled, the deadline (if any) passes -> false
+  bool park(std::chrono::steady_clock::time_point const *deadline) {
+    _waiters.fetch_add(1, std::memory_order_seq_cst);
+    bool res = true;
+    while (!consume()) {
+      struct timespec ts;
+      if (deadline != nullptr && !detail::remaining(*deadline, ts)) {
+        res = false;
+        break;
+      }
+      FutexWait(_signaled, 0, deadline != nullptr ? &ts : nullptr);
+    }
+    _waiters.fetch_sub(1, std::memory_order_relaxed);
+    return res;
+  }
+
+public:
+  explicit AutoResetEvent(bool set = false) : _signaled(set ? 1 : 0) {}
+  AutoResetEvent(AutoResetEvent const &) = delete;
+  void operator=(AutoResetEvent const &) = delete;
+
+  void Set() {
+    if (_signaled.load(std::memory_order_relaxed) == 1)
+      return;
+    // seq_cst pairs with the waiter's registration: either we see it, or
+    // it sees the signal before sleeping
+    _signaled.exchange(1, std::memory_order_seq_cst);
+    if (_waiters.load(std::memory_order_seq_cst) > 0)
+      FutexWake(_signaled, 1);
+  }
+
+  // consume the signal if there is one
+  bool TryWait() { return consume(); }
+
+  void Wait() {
+    for (int i = 0, n = detail::spinRounds(); i < n; i++) {
+      if (consume())
+        return;
+      detail::CpuRelax();
+    }
+    park(nullptr);
+  }
+
+  // false on timeout
+  template <class Rep, class Period>
+  bool WaitFor(std::chrono::duration<Rep, Period> timeout) {
+    if (consume())
+      return true;
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    return park(&deadline);
+  }
+};
+
+// counting semaphore; Acquire() with permits left is one CAS, Release()
+// only enters the kernel when a thread sleeps
+class Semaphore {
+private:
+  std::atomic<uint32_t> _count;
+  std::atomic<uint32_t> _waiters{0};
+
+  bool park(std::chrono::steady_clock::time_point const *deadline) {
+    _waiters.fetch_add(1, std::memory_order_seq_cst);
+    bool res = true;
+    while (!TryAcquire()) {
+      struct timespec ts;
+      if (deadline != nullptr && !detail::remaining(*deadline, ts)) {
+        res = false;
+        break;
+      }
+      FutexWait(_count, 0, deadline != nullptr ? &ts : nullptr);
+    }
+    _waiters.fetch_sub(1, std::memory_order_relaxed);
+    return res;
+  }
+
+public:
+  explicit Semaphore(uint32_t initial = 0) : _count(initial) {}
+  Semaphore(Semaphore const &) = delete;
+  void operator=(Semaphore const &) = delete;
+
+  bool TryAcquire() {
+    auto c = _count.load(std::memory_order_relaxed);
+    while (c > 0)
+      if (_count.compare_exchange_weak(c, c - 1, std::memory_order_acquire,
+                                       std::memory_order_relaxed))
+        return true;
+    return false;
+  }
+
+  void Acquire() {
+    for (int i = 0, n = detail::spinRounds(); i < n; i++) {
+      if (TryAcquire())
+        return;
+      detail::CpuRelax();
+    }
+    park(nullptr);
+  }
+
+  // false on timeout
+  template <class Rep, class Period>
+  bool TryAcquireFor(std::chrono::duration<Rep, Period> timeout) {
+    if (TryAcquire())
+      return true;
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    return park(&deadline);
+  }
+
+  void Release(uint32_t n = 1) {
+    _count.fetch_add(n, std::memory_order_seq_cst);
+    if (_waiters.load(std::memory_order_seq_cst) > 0)
+      FutexWake(_count, static_cast<int>(n));
+  }
+
+  uint32_t Available() const { return _count.load(std::memory_order_relaxed); }
+};
+
+// single-use countdown: Wait() returns once CountDown() was called count
+// times in total
+class Latch {
+private:
+  std::atomic<uint32_t> _count;
+  std::atomic<uint32_t> _waiting{0};
+
+public:
+  explicit Latch(uint32_t count) : _count(count) {}
+  Latch(Latch const &) = delete;
+  void operator=(Latch const &) = delete;
+
+  void CountDown(uint32_t n = 1) {
+    if (_count.fetch_sub(n, std::memory_order_seq_cst) == n &&
+        _waiting.load(std::memory_order_seq_cst) != 0)
+      FutexWakeAll(_count);
+  }
+
+  bool TryWait() const { return _count.load(std::memory_order_acquire) == 0; }
+
+  void Wait() {
+    for (int i = 0, n = detail::spinRounds(); i < n; i++) {
+      if (TryWait())
+        return;
+      detail::CpuRelax();
+    }
+    _waiting.store(1, std::memory_order_seq_cst);
+    uint32_t c;
+    while ((c = _count.load(std::memory_order_acquire)) != 0)
+      FutexWait(_count, c);
+  }
+
+  void ArriveAndWait(uint32_t n = 1) {
+    CountDown(n);
+    Wait();
+  }
+};
+
+// reusable barrier for a fixed number of threads; waiters spin briefly,
+// since the phase usually ends soon, then sleep
+class Barrier {
+private:
+  uint32_t const _threads;
+  std::atomic<uint32_t> _arrived{0};
+  std::atomic<uint32_t> _phase{0};
+  std::atomic<uint32_t> _sleepers{0};
+
+public:
+  explicit Barrier(uint32_t threads) : _threads(threads) {}
+  Barrier(Barrier const &) = delete;
+  void operator=(Barrier const &) = delete;
+
+  // true in exactly one thread per phase, the last to arrive
+  bool ArriveAndWait() {
+    auto phase = _phase.load(std::memory_order_acquire);
+    if (_arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == _threads) {
+      // nobody arrives for the next phase before seeing the new one
+      _arrived.store(0, std::memory_order_relaxed);
+      _phase.fetch_add(1, std::memory_order_seq_cst);
+      if (_sleepers.load(std::memory_order_seq_cst) != 0)
+        FutexWakeAll(_phase);
+      return true;
+    }
+    for (int i = 0, n = detail::spinRounds() * 8; i < n; i++) {
+      if (_phase.load(std::memory_order_acquire) != phase)
+        return false;
+      detail::CpuRelax();
+    }
+    _sleepers.fetch_add(1, std::memory_order_seq_cst);
+    while (_phase.load(std::memory_order_acquire) == phase)
+      FutexWait(_phase, phase);
+    _sleepers.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+  }
+};
+
+} // namespace THREAD
+
+#endif
@@ -0,0 +1,228 @@
+#ifndef SINO_LOCK_H
+#define SINO_LOCK_H
+
+// lock types with the standard Lockable interface (lock/try_lock/unlock),
+// usable with std::lock_guard, std::unique_lock, std::scoped_lock
+//
+// SpinLock       test-and-test-and-set with exponential PAUSE backoff,
+//                for critical sections of a few dozen instructions
+// TicketLock     FIFO fair spin lock, no starvation under contention
+// AdaptiveMutex  spins a bounded number of rounds, then parks on a futex;
+//                the safe default when the hold time is unknown
+//
+// Counting = true adds contention counters (acquisitions, spin rounds,
+// futex parks) on their own cache line, false compiles them out
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+#include "system/futex.h"
+
+namespace THREAD {
+
+struct LockStats {
+  uint64_t acquisitions{0};
+  // PAUSE rounds spent waiting
+  uint64_t spins{0};
+  // futex sleeps (AdaptiveMutex only)
+  uint64_t parks{0};
+};
+
+namespace detail {
+
+template <bool Enabled> struct LockCounters {
+  void Acquired(uint64_t) {}
+  void Parked() {}
+  LockStats Get() const { return {}; }
+  void Reset() {}
+};
+
+template <> struct alignas(64) LockCounters<true> {
+  std::atomic<uint64_t> acquisitions{0};
+  std::atomic<uint64_t> spins{0};
+  std::atomic<uint64_t> parks{0};
+
+  void Acquired(uint64_t spun) {
+    acquisitions.fetch_add(1, std::memory_order_relaxed);
+    if (spun > 0)
+      spins.fetch_add(spun, std::memory_order_relaxed);
+  }
+  void Parked() { parks.fetch_add(1, std::memory_order_relaxed); }
+  LockStats Get() const {
+    return {acquisitions.load(std::memory_order_relaxed),
+            spins.load(std::memory_order_relaxed),
+            parks.load(std::memory_order_relaxed)};
+  }
+  void Reset() {
+    acquisitions.store(0, std::memory_order_relaxed);
+    spins.store(0, std::memory_order_relaxed);
+    parks.store(0, std::memory_order_relaxed);
+  }
+};
+
+} // namespace detail
+
+// the lock word has a cache line to itself, a neighbour's writes don't
+// bounce it
+template <bool Counting = false> class SpinLock {
+private:
+  alignas(64) std::atomic<bool> _locked{false};
+  detail::LockCounters<Counting> _counters{};
+
+  static constexpr uint32_t MAX_BACKOFF = 64;
+
+public:
+  SpinLock() = default;
+  SpinLock(SpinLock const &) = delete;
+  void operator=(SpinLock const &) = delete;
+
+  void lock() {
+    uint64_t spun = 0;
+    uint32_t backoff = 1;
+    // the exchange only runs when the lock looked free, waiters spin on a
+    // shared read-only copy of the line
+    while (_locked.exchange(true, std::memory_order_acquire)) {
+      do {
+        for (uint32_t i = 0; i < backoff; i++)
+          detail::CpuRelax();
+        spun += backoff;
+        backoff = std::min(backoff * 2, MAX_BACKOFF);
+      } while (_locked.load(std::memory_order_relaxed));
+    }
+    _counters.Acquired(spun);
+  }
+
+  bool try_lock() {
+    if (_locked.load(std::memory_order_relaxed) ||
+        _locked.exchange(true, std::memory_order_acquire))
+      return false;
+    _counters.Acquired(0);
+    return true;
+  }
+
+  void unlock() { _locked.store(false, std::memory_order_release); }
+
+  LockStats Stats() const { return _counters.Get(); }
+  void ResetStats() { _counters.Reset(); }
+};
+
+// threads get the lock in the order they asked for it
+// waiters back off in proportion to their distance from the head of the line
+template <bool Counting = false> class TicketLock {
+private:
+  alignas(64) std::atomic<uint32_t> _next{0};
+  std::atomic<uint32_t> _serving{0};
+  detail::LockCounters<Counting> _counters{};
+
+public:
+  TicketLock() = default;
+  TicketLock(TicketLock const &) = delete;
+  void operator=(TicketLock const &) = delete;
+
+  void lock() {
+    auto ticket = _next.fetch_add(1, std::memory_order_relaxed);
+    uint64_t spun = 0;
+    while (true) {
+      auto serving = _serving.load(std::memory_order_acquire);
+      if (serving == ticket)
+        break;
+      uint32_t rounds = (ticket - serving) * 16;
+      for (uint32_t i = 0; i < rounds; i++)
+        detail::CpuRelax();
+      spun += rounds;
+    }
+    _counters.Acquired(spun);
+  }
+
+  bool try_lock() {
+    auto serving = _serving.load(std::memory_order_acquire);
+    auto expected = serving;
+    if (!_next.compare_exchange_strong(expected, serving + 1,
+                                       std::memory_order_acquire,
+                                       std::memory_order_relaxed))
+      return false;
+    _counters.Acquired(0);
+    return true;
+  }
+
+  void unlock() {
+    // only the holder writes _serving
+    _serving.store(_serving.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+  }
+
+  LockStats Stats() const { return _counters.Get(); }
+  void ResetStats() { _counters.Reset(); }
+};
+
+// futex mutex with a bounded spin phase ("Futexes Are Tricky", Drepper)
+// 0 unlocked, 1 locked, 2 locked and somebody may sleep on it; unlock()
+// only calls into the kernel in state 2
+template <bool Counting = false> class AdaptiveMutex {
+private:
+  alignas(64) std::atomic<uint32_t> _state{0};
+  uint32_t _spin_limit;
+  detail::LockCounters<Counting> _counters{};
+
+public:
+  // spinLimit: PAUSE rounds before parking, 0 parks right away
+  explicit AdaptiveMutex(uint32_t spinLimit = 128) : _spin_limit(spinLimit) {}
+  AdaptiveMutex(AdaptiveMutex const &) = delete;
+  void operator=(AdaptiveMutex const &) = delete;
+
+  void lock() {
+    uint32_t expected = 0;
+    if (_state.compare_exchange_strong(expected, 1,
+                                       std::memory_order_acquire,
+                                       std::memory_order_relaxed)) {
+      _counters.Acquired(0);
+      return;
+    }
+    uint64_t spun = 0;
+    // spin while the holder may be about to release
+    while (spun < _spin_limit) {
+      detail::CpuRelax();
+      spun++;
+      expected = _state.load(std::memory_order_relaxed);
+      if (expected == 0 &&
+          _state.compare_exchange_weak(expected, 1,
+                                       std::memory_order_acquire,
+                                       std::memory_order_relaxed)) {
+        _counters.Acquired(spun);
+        return;
+      }
+      // somebody already sleeps, spinning won't get ahead of them
+      if (expected == 2)
+        break;
+    }
+    // taking it in state 2 is conservative: an extra wake at unlock
+    while (_state.exchange(2, std::memory_order_acquire) != 0) {
+      _counters.Parked();
+      FutexWait(_state, 2);
+    }
+    _counters.Acquired(spun);
+  }
+
+  bool try_lock() {
+    uint32_t expected = 0;
+    if (!_state.compare_exchange_strong(expected, 1,
+                                        std::memory_order_acquire,
+                                        std::memory_order_relaxed))
+      return false;
+    _counters.Acquired(0);
+    return true;
+  }
+
+  void unlock() {
+    if (_state.exchange(0, std::memory_order_release) == 2)
+      FutexWake(_state, 1);
+  }
+
+  LockStats Stats() const { return _counters.Get(); }
+  void ResetStats() { _counters.Reset(); }
+};
+
+} // namespace THREAD
+
+#endif
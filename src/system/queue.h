@@ -0,0 +1,447 @@
+#ifndef SINO_QUEUE_H
+#define SINO_QUEUE_H
+
+// bounded lock-free queues
+//
+// MpmcQueue  any number of producers and consumers (Vyukov): every cell
+//            carries a sequence number telling whose turn it is, so a push
+//            or pop is one CAS on the shared index plus plain accesses to
+//            its own cell
+// SpscRing   exactly one producer and one consumer, wait-free: each side
+//            owns one index and keeps a cached copy of the other's, which
+//            it rereads only when the ring looks full/empty
+//
+// both offer TryPush/TryPop and batch versions; Blocking<Queue> adds
+// Push/Pop that spin briefly, then futex-wait, only while the queue is
+// full/empty; a non-waiting side pays one fence and one load
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <utility>
+
+#include "system/futex.h"
+#include "system/lock.h"
+
+namespace THREAD {
+
+namespace detail {
+
+constexpr std::size_t CACHE_LINE = 64;
+
+inline std::size_t roundUpPow2(std::size_t n) {
+  std::size_t cap = 2;
+  while (cap < n)
+    cap <<= 1;
+  return cap;
+}
+
+// uninitialised storage for one T, the queues construct on push and
+// destroy on pop
+template <class T> struct Slot {
+  alignas(T) unsigned char bytes[sizeof(T)];
+
+  T *get() { return std::launder(reinterpret_cast<T *>(bytes)); }
+  template <class... Args> void construct(Args &&...args) {
+    new (bytes) T(std::forward<Args>(args)...);
+  }
+  T take() {
+    T value(std::move(*get()));
+    get()->~T();
+    return value;
+  }
+};
+
+} // namespace detail
+
+template <class T> class MpmcQueue {
+private:
+  struct Cell {
+    // pos: free for the push of pos; pos + 1: full for the pop of pos
+    std::atomic<std::size_t> seq;
+    detail::Slot<T> slot;
+  };
+
+  std::size_t _mask;
+  std::unique_ptr<Cell[]> _cells;
+  alignas(detail::CACHE_LINE) std::atomic<std::size_t> _enqueue{0};
+  alignas(detail::CACHE_LINE) std::atomic<std::size_t> _dequeue{0};
+
+  // claim up to max consecutive cells from index, those whose sequence is
+  // their position + offset; returns how many, 0 if the queue is full
+  // (offset 0) or empty (offset 1)
+  std::size_t claim(std::atomic<std::size_t> &index, std::size_t max,
+                    std::size_t offset, std::size_t &first) {
+    auto pos = index.load(std::memory_order_relaxed);
+    while (true) {
+      auto seq = _cells[pos & _mask].seq.load(std::memory_order_acquire);
+      auto diff = static_cast<intptr_t>(seq - (pos + offset));
+      if (diff < 0)
+        return 0;
+      if (diff > 0) {
+        // another thread took pos meanwhile
+        pos = index.load(std::memory_order_relaxed);
+        continue;
+      }
+      std::size_t n = 1;
+      while (n < max && _cells[(pos + n) & _mask].seq.load(
+                            std::memory_order_acquire) == pos + n + offset)
+        n++;
+      // the cells stay ready until whoever owns their position moves on,
+      // winning the CAS makes that us
+      if (index.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed,
+                                      std::memory_order_relaxed)) {
+        first = pos;
+        return n;
+      }
+    }
+  }
+
+public:
+  using value_type = T;
+
+  // capacity is rounded up to a power of two
+  explicit MpmcQueue(std::size_t capacity)
+      : _mask(detail::roundUpPow2(capacity) - 1),
+        _cells(new Cell[_mask + 1]) {
+    for (std::size_t i = 0; i <= _mask; i++)
+      _cells[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  ~MpmcQueue() {
+    auto tail = _enqueue.load(std::memory_order_relaxed);
+    for (auto pos = _dequeue.load(std::memory_order_relaxed); pos != tail;
+         pos++)
+      _cells[pos & _mask].slot.get()->~T();
+  }
+
+  MpmcQueue(MpmcQueue const &) = delete;
+  void operator=(MpmcQueue const &) = delete;
+
+  std::size_t Capacity() const { return _mask + 1; }
+
+  // only a snapshot while others push and pop
+  std::size_t SizeApprox() const {
+    auto tail = _enqueue.load(std::memory_order_relaxed);
+    auto head = _dequeue.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+  }
+
+  template <class... Args> bool TryEmplace(Args &&...args) {
+    std::size_t pos;
+    if (claim(_enqueue, 1, 0, pos) == 0)
+      return false;
+    auto &cell = _cells[pos & _mask];
+    cell.slot.construct(std::forward<Args>(args)...);
+    cell.seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool TryPush(T const &value) { return TryEmplace(value); }
+  bool TryPush(T &&value) { return TryEmplace(std::move(value)); }
+
+  bool TryPop(T &out) {
+    std::size_t pos;
+    if (claim(_dequeue, 1, 1, pos) == 0)
+      return false;
+    auto &cell = _cells[pos & _mask];
+    out = cell.slot.take();
+    cell.seq.store(pos + _mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  // move in up to count values from first, one CAS for the batch
+  // returns how many were taken
+  template <class It> std::size_t TryPushBatch(It first, std::size_t count) {
+    std::size_t pos;
+    auto n = claim(_enqueue, count, 0, pos);
+    for (std::size_t i = 0; i < n; i++, ++first) {
+      auto &cell = _cells[(pos + i) & _mask];
+      cell.slot.construct(std::move(*first));
+      cell.seq.store(pos + i + 1, std::memory_order_release);
+    }
+    return n;
+  }
+
+  // move out up to count values, returns how many
+  template <class It> std::size_t TryPopBatch(It out, std::size_t count) {
+    std::size_t pos;
+    auto n = claim(_dequeue, count, 1, pos);
+    for (std::size_t i = 0; i < n; i++, ++out) {
+      auto &cell = _cells[(pos + i) & _mask];
+      *out = cell.slot.take();
+      cell.seq.store(pos + i + _mask + 1, std::memory_order_release);
+    }
+    return n;
+  }
+};
+
+template <class T> class SpscRing {
+private:
+  // consumer side
+  alignas(detail::CACHE_LINE) std::atomic<std::size_t> _head{0};
+  std::size_t _tail_cache{0};
+
+  // producer side
+  alignas(detail::CACHE_LINE) std::atomic<std::size_t> _tail{0};
+  std::size_t _head_cache{0};
+
+  alignas(detail::CACHE_LINE) std::size_t _mask;
+  std::unique_ptr<detail::Slot<T>[]> _slots;
+
+  // free slots as the producer sees them, rereads _head only when short
+  std::size_t writable(std::size_t tail, std::size_t want) {
+    auto free = _mask + 1 - (tail - _head_cache);
+    if (free < want) {
+      _head_cache = _head.load(std::memory_order_acquire);
+      free = _mask + 1 - (tail - _head_cache);
+    }
+    return free;
+  }
+
+  std::size_t readable(std::size_t head, std::size_t want) {
+    auto full = _tail_cache - head;
+    if (full < want) {
+      _tail_cache = _tail.load(std::memory_order_acquire);
+      full = _tail_cache - head;
+    }
+    return full;
+  }
+
+public:
+  using value_type = T;
+
+  // capacity is rounded up to a power of two
+  explicit SpscRing(std::size_t capacity)
+      : _mask(detail::roundUpPow2(capacity) - 1),
+        _slots(new detail::Slot<T>[_mask + 1]) {}
+
+  ~SpscRing() {
+    auto head = _head.load(std::memory_order_relaxed);
+    auto tail = _tail.load(std::memory_order_relaxed);
+    for (; head != tail; head++)
+      _slots[head & _mask].get()->~T();
+  }
+
+  SpscRing(SpscRing const &) = delete;
+  void operator=(SpscRing const &) = delete;
+
+  std::size_t Capacity() const { return _mask + 1; }
+
+  std::size_t SizeApprox() const {
+    return _tail.load(std::memory_order_relaxed) -
+           _head.load(std::memory_order_relaxed);
+  }
+
+  // producer only
+  template <class... Args> bool TryEmplace(Args &&...args) {
+    auto tail = _tail.load(std::memory_order_relaxed);
+    if (writable(tail, 1) == 0)
+      return false;
+    _slots[tail & _mask].construct(std::forward<Args>(args)...);
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool TryPush(T const &value) { return TryEmplace(value); }
+  bool TryPush(T &&value) { return TryEmplace(std::move(value)); }
+
+  // consumer only
+  bool TryPop(T &out) {
+    auto head = _head.load(std::memory_order_relaxed);
+    if (readable(head, 1) == 0)
+      return false;
+    out = _slots[head & _mask].take();
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // producer only, one index store for the batch
+  template <class It> std::size_t TryPushBatch(It first, std::size_t count) {
+    auto tail = _tail.load(std::memory_order_relaxed);
+    auto n = std::min(count, writable(tail, count));
+    for (std::size_t i = 0; i < n; i++, ++first)
+      _slots[(tail + i) & _mask].construct(std::move(*first));
+    if (n > 0)
+      _tail.store(tail + n, std::memory_order_release);
+    return n;
+  }
+
+  // consumer only
+  template <class It> std::size_t TryPopBatch(It out, std::size_t count) {
+    auto head = _head.load(std::memory_order_relaxed);
+    auto n = std::min(count, readable(head, count));
+    for (std::size_t i = 0; i < n; i++, ++out)
+      *out = _slots[(head + i) & _mask].take();
+    if (n > 0)
+      _head.store(head + n, std::memory_order_release);
+    return n;
+  }
+};
+
+// blocking Push/Pop over MpmcQueue or SpscRing (an SpscRing still allows
+// one producer and one consumer only)
+//
+// a side that finds the queue full/empty spins a little, then registers
+// as waiting and sleeps on a futex word the other side bumps; the other
+// side only touches the futex when someone is registered
+template <class Queue> class Blocking {
+public:
+  using value_type = typename Queue::value_type;
+
+private:
+  // one wait side: the futex word and how many registered to sleep on it
+  struct alignas(detail::CACHE_LINE) Waiters {
+    std::atomic<uint32_t> seq{0};
+    std::atomic<uint32_t> count{0};
+  };
+
+  Queue _queue;
+  // consumers wait here for items, producers for room
+  Waiters _items;
+  Waiters _room;
+  std::atomic<bool> _closed{false};
+  uint32_t _spin_limit;
+
+  static void notify(Waiters &w) {
+    // pairs with the fence in wait(): either the waiter sees our change to
+    // the queue, or we see it registered
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (w.count.load(std::memory_order_relaxed) == 0)
+      return;
+    // the waker takes over all registrations and wakes everybody, so the
+    // pushes/pops that follow before the sleepers run skip the syscall;
+    // whoever still finds the queue full/empty registers again
+    if (w.count.exchange(0, std::memory_order_relaxed) == 0)
+      return;
+    w.seq.fetch_add(1, std::memory_order_release);
+    FutexWakeAll(w.seq);
+  }
+
+  // retry attempt until it succeeds or the queue is closed
+  template <class F> bool wait(Waiters &w, F &&attempt) {
+    for (uint32_t i = 0; i < _spin_limit; i++) {
+      if (attempt())
+        return true;
+      if (_closed.load(std::memory_order_acquire))
+        return false;
+      detail::CpuRelax();
+    }
+    while (true) {
+      // seq before registering: a notify() that takes our registration
+      // bumps seq past this value, so FutexWait() returns at once instead
+      // of sleeping with nobody left to wake us
+      auto seq = w.seq.load(std::memory_order_acquire);
+      // a registration left behind by a successful attempt costs the other
+      // side one extra wake at most
+      w.count.fetch_add(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (attempt())
+        return true;
+      if (_closed.load(std::memory_order_acquire))
+        return false;
+      FutexWait(w.seq, seq);
+    }
+  }
+
+public:
+  // spinLimit: attempts before sleeping
+  explicit Blocking(std::size_t capacity, uint32_t spinLimit = 64)
+      : _queue(capacity), _spin_limit(spinLimit) {}
+
+  Blocking(Blocking const &) = delete;
+  void operator=(Blocking const &) = delete;
+
+  std::size_t Capacity() const { return _queue.Capacity(); }
+  std::size_t SizeApprox() const { return _queue.SizeApprox(); }
+
+  bool TryPush(value_type value) {
+    if (!_queue.TryPush(std::move(value)))
+      return false;
+    notify(_items);
+    return true;
+  }
+
+  bool TryPop(value_type &out) {
+    if (!_queue.TryPop(out))
+      return false;
+    notify(_room);
+    return true;
+  }
+
+  // wait for room; false if the queue was closed, value is then dropped
+  bool Push(value_type value) {
+    if (_closed.load(std::memory_order_acquire))
+      return false;
+    if (!wait(_room, [&] { return _queue.TryPush(std::move(value)); }))
+      return false;
+    notify(_items);
+    return true;
+  }
+
+  // wait for an item; false once the queue is closed and drained
+  bool Pop(value_type &out) {
+    if (!wait(_items, [&] { return _queue.TryPop(out); })) {
+      // items pushed just before Close() are still handed out
+      if (!_queue.TryPop(out))
+        return false;
+    }
+    notify(_room);
+    return true;
+  }
+
+  // push all count values, waiting for room as needed
+  // returns how many went in, less than count only if closed
+  template <class It> std::size_t PushBatch(It first, std::size_t count) {
+    std::size_t done = 0;
+    while (done < count && !_closed.load(std::memory_order_acquire)) {
+      std::size_t n = 0;
+      if (!wait(_room, [&] {
+            n = _queue.TryPushBatch(first, count - done);
+            return n > 0;
+          }))
+        break;
+      std::advance(first, n);
+      done += n;
+      notify(_items);
+    }
+    return done;
+  }
+
+  // wait for at least one item, then take up to count
+  // 0 once the queue is closed and drained
+  template <class It> std::size_t PopBatch(It out, std::size_t count) {
+    std::size_t n = 0;
+    if (!wait(_items, [&] {
+          n = _queue.TryPopBatch(out, count);
+          return n > 0;
+        }))
+      n = _queue.TryPopBatch(out, count);
+    if (n > 0)
+      notify(_room);
+    return n;
+  }
+
+  // wake every waiter; Push fails from now on, Pop drains what is left
+  void Close() {
+    _closed.store(true, std::memory_order_release);
+    for (auto *w : {&_items, &_room}) {
+      w->seq.fetch_add(1, std::memory_order_release);
+      FutexWakeAll(w->seq);
+    }
+  }
+
+  bool Closed() const { return _closed.load(std::memory_order_acquire); }
+};
+
+template <class T> using BlockingMpmcQueue = Blocking<MpmcQueue<T>>;
+template <class T> using BlockingSpscRing = Blocking<SpscRing<T>>;
+
+} // namespace THREAD
+
+#endif
@@ -0,0 +1,454 @@
+#ifndef SINO_SPAWN_H
+#define SINO_SPAWN_H
+
+// posix_spawnp() posix_spawn_file_actions_addclosefrom_np() pipe2()
+// pidfd_open() pidfd_send_signal() waitpid()
+//
+// starting helper processes without fork()
+// fork() copies the parent's page tables (and marks every page
+// copy-on-write), which costs milliseconds in a process of a few GB;
+// posix_spawn() in glibc runs the child with clone(CLONE_VM|CLONE_VFORK)
+// on a small stack until it calls execve(), so the cost no longer grows
+// with the parent's size
+//
+// the child gets only stdin/stdout/stderr: the spawn file actions close
+// every other fd (close_range() under closefrom_np), so a descriptor opened
+// without O_CLOEXEC by another thread can't leak into it; before glibc 2.34
+// the fds in /proc/self/fd are closed one by one instead, which misses one
+// opened concurrently with Spawn()
+//
+// piped stdio is non-blocking on the parent's side, Child::Attach()
+// registers it with an event loop together with a pidfd that becomes
+// readable when the child exits
+//
+// the child must be reaped by its Child only: waitpid(-1) elsewhere or
+// SIGCHLD set to SIG_IGN take the exit status away from it
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "general/inc_exception.h"
+
+// __GLIBC_PREREQ is glibc's own, it can't share an #if with the check
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 34)
+#define SINO_SPAWN_CLOSEFROM
+#endif
+#endif
+
+extern char **environ;
+
+namespace PROC {
+
+enum class Stdio : uint8_t {
+  INHERIT, // share the parent's descriptor
+  PIPE,    // a pipe, the parent's end is Child::Stdin()/Stdout()/Stderr()
+  NUL,     // /dev/null
+};
+
+struct SpawnOptions {
+  Stdio in{Stdio::INHERIT};
+  Stdio out{Stdio::INHERIT};
+  Stdio err{Stdio::INHERIT};
+  // NAME=value strings ending with nullptr, nullptr inherits environ
+  char *const *env{nullptr};
+  // working directory of the child, empty keeps the parent's
+  std::string cwd{};
+  // put the child in a process group of its own
+  bool newProcessGroup{false};
+};
+
+class Child {
+public:
+  // a chunk of output, valid during the call only; empty at end of file
+  using Output = std::function<void(std::string_view)>;
+  // waitpid() status, use WIFEXITED() WEXITSTATUS() ... on it
+  using Exit = std::function<void(int)>;
+
+private:
+  pid_t _pid;
+  int _pidfd;
+  int _stdin;
+  int _stdout;
+  int _stderr;
+  int _status{-1};
+  bool _reaped{false};
+
+  // set while attached to a loop
+  std::function<void(int)> _unregister{};
+  // the fds Attach() registered, only those are unregistered
+  std::vector<int> _registered{};
+  Output _on_stdout{};
+  Output _on_stderr{};
+  Exit _on_exit{};
+  // attached outputs not at end of file yet
+  int _open_outputs{0};
+  bool _exit_seen{false};
+
+  static void closeFd(int &fd) {
+    if (fd != -1) {
+      close(fd);
+      fd = -1;
+    }
+  }
+
+  void detach(int &fd) {
+    auto it = std::find(_registered.begin(), _registered.end(), fd);
+    if (fd != -1 && it != _registered.end()) {
+      _registered.erase(it);
+      _unregister(fd);
+    }
+    closeFd(fd);
+  }
+
+  // on_exit comes after the last output chunk, so it waits for both
+  // pipes to reach end of file (a grandchild holding them open delays it)
+  void maybeExit() {
+    if (!_exit_seen || _open_outputs > 0 || !_on_exit)
+      return;
+    auto on_exit = std::move(_on_exit);
+    _on_exit = nullptr;
+    on_exit(_status);
+  }
+
+  // read until the pipe is empty; a short read means it was drained, so
+  // the EAGAIN round trip is skipped
+  void drain(int &fd, Output &on_output) {
+    static thread_local char buffer[64 * 1024];
+    while (fd != -1) {
+      auto n = read(fd, buffer, sizeof buffer);
+      if (n == -1) {
+        if (errno == EINTR)
+          continue;
+        if (errno == EAGAIN)
+          return;
+        n = 0; // treat a read error as end of file
+      }
+      if (n == 0) {
+        detach(fd);
+        _open_outputs--;
+        if (on_output)
+          on_output({});
+        maybeExit();
+        return;
+      }
+      if (on_output)
+        on_output(std::string_view(buffer, static_cast<std::size_t>(n)));
+      if (static_cast<std::size_t>(n) < sizeof buffer)
+        return;
+    }
+  }
+
+  void exited() {
+    if (!TryWait())
+      return; // not yet, the pidfd was readable for another reason
+    detach(_pidfd);
+    _exit_seen = true;
+    maybeExit();
+  }
+
+public:
+  Child(pid_t pid, int pidfd, int in, int out, int err)
+      : _pid(pid), _pidfd(pidfd), _stdin(in), _stdout(out), _stderr(err) {}
+
+  // neither kills nor waits for the child, see Wait()/Kill()
+  ~Child() {
+    detach(_stdin);
+    detach(_stdout);
+    detach(_stderr);
+    detach(_pidfd);
+    // collect it if it is already gone, errors don't matter here
+    int status;
+    if (!_reaped)
+      waitpid(_pid, &status, WNOHANG);
+  }
+
+  Child(Child const &) = delete;
+  void operator=(Child const &) = delete;
+
+  pid_t Pid() const { return _pid; }
+  // -1 on kernels without pidfd_open()
+  int PidFd() const { return _pidfd; }
+  // -1 unless the stream is Stdio::PIPE
+  int Stdin() const { return _stdin; }
+  int Stdout() const { return _stdout; }
+  int Stderr() const { return _stderr; }
+
+  // the child reads end of file
+  void CloseStdin() { detach(_stdin); }
+
+  bool Exited() const { return _reaped; }
+  // waitpid() status once Exited()
+  int Status() const { return _status; }
+
+  // reap without blocking, true once the child has exited
+  bool TryWait() {
+    if (_reaped)
+      return true;
+    int status;
+    pid_t res;
+    while ((res = waitpid(_pid, &status, WNOHANG)) == -1 && errno == EINTR) {
+    }
+    if (res == -1)
+      throw std::runtime_error(strerror(errno));
+    if (res == 0)
+      return false;
+    _status = status;
+    _reaped = true;
+    return true;
+  }
+
+  // block until the child exits, return its waitpid() status
+  int Wait() {
+    if (_reaped)
+      return _status;
+    int status;
+    while (waitpid(_pid, &status, 0) == -1)
+      if (errno != EINTR)
+        throw std::runtime_error(strerror(errno));
+    _status = status;
+    _reaped = true;
+    return _status;
+  }
+
+  // the pidfd can't hit a recycled pid; no-op once reaped
+  void Kill(int sig = SIGTERM) {
+    if (_reaped)
+      return;
+    int res = _pidfd != -1
+                  ? static_cast<int>(syscall(SYS_pidfd_send_signal, _pidfd,
+                                             sig, nullptr, 0))
+                  : kill(_pid, sig);
+    if (res == -1 && errno != ESRCH)
+      throw std::runtime_error(strerror(errno));
+  }
+
+  // loop.Register(fd, read_callback, write_callback, error_callback) and
+  // loop.Unregister(fd, read, write, error) as IOMUL::Multiplex provides
+  // piped stdout/stderr go to the handlers as they arrive, the exit status
+  // after both reached end of file; stdin stays with the caller
+  // the Child must outlive the registration (destroying it unregisters);
+  // on_exit may destroy it, the output handlers may not
+  template <class Loop>
+  void Attach(Loop &loop, Output on_stdout, Output on_stderr = nullptr,
+              Exit on_exit = nullptr) {
+    if (_unregister)
+      throw std::runtime_error("Child already attached");
+    if (_pidfd == -1 && on_exit)
+      throw std::runtime_error("no pidfd to watch the child's exit");
+    _on_stdout = std::move(on_stdout);
+    _on_stderr = std::move(on_stderr);
+    _on_exit = std::move(on_exit);
+    _unregister = [&loop](int fd) { loop.Unregister(fd, true, true, true); };
+    // POLLHUP arrives as an error, it is end of file for a pipe
+    if (_stdout != -1) {
+      _open_outputs++;
+      auto out = [this] { drain(_stdout, _on_stdout); };
+      loop.Register(_stdout, out, nullptr, out);
+      _registered.push_back(_stdout);
+    }
+    if (_stderr != -1) {
+      _open_outputs++;
+      auto err = [this] { drain(_stderr, _on_stderr); };
+      loop.Register(_stderr, err, nullptr, err);
+      _registered.push_back(_stderr);
+    }
+    // stays readable after the exit, also if already reaped
+    if (_pidfd != -1) {
+      auto done = [this] { exited(); };
+      loop.Register(_pidfd, done, nullptr, done);
+      _registered.push_back(_pidfd);
+    }
+  }
+};
+
+namespace detail {
+
+// frees what posix_spawnp() needed, and the pipes if it failed
+class SpawnState {
+private:
+  posix_spawn_file_actions_t _actions;
+  posix_spawnattr_t _attr;
+  std::vector<int> _fds{};
+
+public:
+  SpawnState() {
+    int res = posix_spawn_file_actions_init(&_actions);
+    if (res != 0)
+      throw std::runtime_error(strerror(res));
+    res = posix_spawnattr_init(&_attr);
+    if (res != 0) {
+      posix_spawn_file_actions_destroy(&_actions);
+      throw std::runtime_error(strerror(res));
+    }
+  }
+
+  ~SpawnState() {
+    for (auto fd : _fds)
+      close(fd);
+    posix_spawnattr_destroy(&_attr);
+    posix_spawn_file_actions_destroy(&_actions);
+  }
+
+  SpawnState(SpawnState const &) = delete;
+  void operator=(SpawnState const &) = delete;
+
+  posix_spawn_file_actions_t *Actions() { return &_actions; }
+  posix_spawnattr_t *Attr() { return &_attr; }
+
+  static void Check(int res) {
+    if (res != 0)
+      throw std::runtime_error(strerror(res));
+  }
+
+  // sets up `target` in the child, returns the parent's end of a pipe
+  int Stream(Stdio how, int target) {
+    if (how == Stdio::INHERIT)
+      return -1;
+    if (how == Stdio::NUL) {
+      Check(posix_spawn_file_actions_addopen(
+          &_actions, target, "/dev/null", target == 0 ? O_RDONLY : O_WRONLY,
+          0));
+      return -1;
+    }
+    // both ends close-on-exec, dup2() in the child clears it on `target`
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1)
+      throw std::runtime_error(strerror(errno));
+    int child = target == 0 ? fds[0] : fds[1];
+    int parent = target == 0 ? fds[1] : fds[0];
+    _fds.push_back(child);
+    _fds.push_back(parent);
+    // only the parent's end, O_NONBLOCK belongs to the open file
+    if (fcntl(parent, F_SETFL, O_NONBLOCK) == -1)
+      throw std::runtime_error(strerror(errno));
+    Check(posix_spawn_file_actions_adddup2(&_actions, child, target));
+    return parent;
+  }
+
+  // closes every fd from `low` up in the child; without closefrom_np
+  // (glibc < 2.34, other libcs) one action per fd open now, so one opened
+  // by another thread before posix_spawnp() still leaks, and without /proc
+  // nothing is closed beyond what is close-on-exec
+  void CloseFrom(int low) {
+#ifdef SINO_SPAWN_CLOSEFROM
+    Check(posix_spawn_file_actions_addclosefrom_np(&_actions, low));
+#else
+    auto dir = opendir("/proc/self/fd");
+    if (dir == nullptr)
+      return;
+    int self = dirfd(dir);
+    while (auto entry = readdir(dir)) {
+      if (entry->d_name[0] == '.')
+        continue;
+      int fd = atoi(entry->d_name);
+      if (fd < low || fd == self)
+        continue;
+      int res = posix_spawn_file_actions_addclose(&_actions, fd);
+      if (res != 0) {
+        closedir(dir);
+        throw std::runtime_error(strerror(res));
+      }
+    }
+    closedir(dir);
+#endif
+  }
+
+  // the child ends are closed, the parent's ends handed over
+  void Keep(std::initializer_list<int> parents) {
+    for (auto fd : _fds) {
+      bool keep = false;
+      for (auto p : parents)
+        keep = keep || p == fd;
+      if (!keep)
+        close(fd);
+    }
+    _fds.clear();
+  }
+};
+
+} // namespace detail
+
+// argv[0] is searched in PATH unless it contains a '/'
+// argv ends with nullptr; an exec failure (ENOENT, EACCES...) throws here
+inline std::unique_ptr<Child> Spawn(char *const argv[],
+                                    SpawnOptions const &options = {}) {
+  if (argv == nullptr || argv[0] == nullptr)
+    throw std::invalid_argument("Spawn() without a program");
+  using detail::SpawnState;
+  SpawnState state;
+
+  int in = state.Stream(options.in, 0);
+  int out = state.Stream(options.out, 1);
+  int err = state.Stream(options.err, 2);
+  if (!options.cwd.empty())
+    SpawnState::Check(posix_spawn_file_actions_addchdir_np(
+        state.Actions(), options.cwd.c_str()));
+  // after the dup2()s, so only 0 1 2 survive
+  state.CloseFrom(3);
+
+  // an event loop thread often blocks signals (signalfd) or ignores
+  // SIGPIPE, neither is what an exec'd program expects
+  short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+  sigset_t none, reset;
+  sigemptyset(&none);
+  sigemptyset(&reset);
+  sigaddset(&reset, SIGPIPE);
+  SpawnState::Check(posix_spawnattr_setsigmask(state.Attr(), &none));
+  SpawnState::Check(posix_spawnattr_setsigdefault(state.Attr(), &reset));
+  if (options.newProcessGroup) {
+    flags |= POSIX_SPAWN_SETPGROUP;
+    SpawnState::Check(posix_spawnattr_setpgroup(state.Attr(), 0));
+  }
+  SpawnState::Check(posix_spawnattr_setflags(state.Attr(), flags));
+
+  pid_t pid;
+  SpawnState::Check(posix_spawnp(&pid, argv[0], state.Actions(), state.Attr(),
+                                 argv,
+                                 options.env != nullptr ? options.env
+                                                        : environ));
+  // unreaped, so the pid can't be reused before pidfd_open() sees it
+  int pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+  state.Keep({in, out, err});
+  return std::make_unique<Child>(pid, pidfd, in, out, err);
+}
+
+// no string is copied, only pointers to them
+inline std::unique_ptr<Child> Spawn(std::vector<std::string> const &argv,
+                                    SpawnOptions const &options = {}) {
+  std::vector<char *> args;
+  args.reserve(argv.size() + 1);
+  for (auto &it : argv)
+    args.push_back(const_cast<char *>(it.c_str()));
+  args.push_back(nullptr);
+  return Spawn(args.data(), options);
+}
+
+inline std::unique_ptr<Child> Spawn(std::initializer_list<char const *> argv,
+                                    SpawnOptions const &options = {}) {
+  std::vector<char *> args;
+  args.reserve(argv.size() + 1);
+  for (auto it : argv)
+    args.push_back(const_cast<char *>(it));
+  args.push_back(nullptr);
+  return Spawn(args.data(), options);
+}
+
+} // namespace PROC
+
+#endif
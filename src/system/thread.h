@@ -26,8 +26,386 @@
 // pthread_barrier_init() pthread_barrier_destroy()
 // pthread_barrier_wait()
 //
+// placement:
+// sched_setaffinity() sched_getaffinity() pthread_setaffinity_np()
+// pthread_setname_np() pthread_getname_np() getcpu()
+// set_mempolicy() mbind() (raw syscalls, no libnuma)
+//
+#include <fcntl.h>
+#include <linux/mempolicy.h>
 #include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace THREAD {
+
+namespace detail {
+
+inline std::string readSysFile(std::string const &path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    throw std::runtime_error(path + ": " + strerror(errno));
+  std::string res;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof buf)) > 0)
+    res.append(buf, n);
+  int err = errno;
+  close(fd);
+  if (n == -1)
+    throw std::runtime_error(path + ": " + strerror(err));
+  return res;
+}
+
+} // namespace detail
+
+// a set of CPU numbers, below CPU_SETSIZE (1024)
+class CpuSet {
+private:
+  cpu_set_t _set;
+
+  static int parseInt(std::string_view &s) {
+    if (s.empty() || s[0] < '0' || s[0] > '9')
+      throw std::runtime_error("bad cpu list");
+    int n = 0;
+    while (!s.empty() && s[0] >= '0' && s[0] <= '9') {
+      n = n * 10 + (s[0] - '0');
+      if (n >= CPU_SETSIZE)
+        throw std::runtime_error("cpu number out of range");
+      s.remove_prefix(1);
+    }
+    return n;
+  }
+
+public:
+  CpuSet() { CPU_ZERO(&_set); }
+  explicit CpuSet(cpu_set_t const &set) : _set(set) {}
+
+  // the kernel's cpulist format: "0-3,8,10-11", whitespace around is ignored
+  static CpuSet Parse(std::string_view list) {
+    CpuSet res;
+    while (!list.empty() && isspace(static_cast<unsigned char>(list.back())))
+      list.remove_suffix(1);
+    while (!list.empty() && isspace(static_cast<unsigned char>(list[0])))
+      list.remove_prefix(1);
+    while (!list.empty()) {
+      int first = parseInt(list);
+      int last = first;
+      if (!list.empty() && list[0] == '-') {
+        list.remove_prefix(1);
+        last = parseInt(list);
+      }
+      for (int cpu = first; cpu <= last; cpu++)
+        res.Add(cpu);
+      if (!list.empty()) {
+        if (list[0] != ',')
+          throw std::runtime_error("bad cpu list");
+        list.remove_prefix(1);
+      }
+    }
+    return res;
+  }
+
+  static CpuSet Of(int cpu) { return CpuSet().Add(cpu); }
+
+  // the CPUs the process may run on (taskset, cgroup cpusets), read from
+  // the main thread's affinity, so don't pin the main thread first
+  static CpuSet Available() {
+    CpuSet res;
+    if (sched_getaffinity(getpid(), sizeof res._set, &res._set) == -1)
+      throw std::runtime_error(strerror(errno));
+    return res;
+  }
+
+  // the CPUs of a NUMA node
+  static CpuSet OfNode(int node) {
+    return Parse(detail::readSysFile("/sys/devices/system/node/node" +
+                                     std::to_string(node) + "/cpulist"));
+  }
+
+  CpuSet &Add(int cpu) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE)
+      CPU_SET(cpu, &_set);
+    return *this;
+  }
+
+  CpuSet &Remove(int cpu) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE)
+      CPU_CLR(cpu, &_set);
+    return *this;
+  }
+
+  bool Contains(int cpu) const {
+    return cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &_set);
+  }
+
+  int Count() const { return CPU_COUNT(&_set); }
+  bool Empty() const { return Count() == 0; }
+
+  // the n-th CPU of the set in ascending order, wrapping around; -1 if empty
+  int Nth(std::size_t n) const {
+    auto cpus = Cpus();
+    return cpus.empty() ? -1 : cpus[n % cpus.size()];
+  }
+
+  std::vector<int> Cpus() const {
+    std::vector<int> res;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      if (CPU_ISSET(cpu, &_set))
+        res.push_back(cpu);
+    return res;
+  }
+
+  CpuSet operator|(CpuSet const &other) const {
+    CpuSet res;
+    CPU_OR(&res._set, &_set, &other._set);
+    return res;
+  }
+
+  CpuSet operator&(CpuSet const &other) const {
+    CpuSet res;
+    CPU_AND(&res._set, &_set, &other._set);
+    return res;
+  }
+
+  // the CPUs of this set that are not in other, e.g. everything but the
+  // cores serving the latency-critical loops
+  CpuSet operator-(CpuSet const &other) const {
+    CpuSet res = *this;
+    for (int cpu : other.Cpus())
+      res.Remove(cpu);
+    return res;
+  }
+
+  bool operator==(CpuSet const &other) const {
+    return CPU_EQUAL(&_set, &other._set);
+  }
+  bool operator!=(CpuSet const &other) const { return !(*this == other); }
+
+  // back in cpulist format
+  std::string ToString() const {
+    std::string res;
+    auto cpus = Cpus();
+    for (std::size_t i = 0; i < cpus.size();) {
+      auto j = i;
+      while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+        j++;
+      if (!res.empty())
+        res += ',';
+      res += std::to_string(cpus[i]);
+      if (j > i)
+        res += '-' + std::to_string(cpus[j]);
+      i = j + 1;
+    }
+    return res;
+  }
+
+  cpu_set_t const *Native() const { return &_set; }
+};
+
+// pin the calling thread
+inline void SetAffinity(CpuSet const &cpus) {
+  if (sched_setaffinity(0, sizeof(cpu_set_t), cpus.Native()) == -1)
+    throw std::runtime_error(strerror(errno));
+}
+
+inline void SetAffinity(std::thread &thread, CpuSet const &cpus) {
+  int res = pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t),
+                                   cpus.Native());
+  if (res != 0)
+    throw std::runtime_error(strerror(res));
+}
+
+// the calling thread's CPUs
+inline CpuSet GetAffinity() {
+  cpu_set_t set;
+  if (sched_getaffinity(0, sizeof set, &set) == -1)
+    throw std::runtime_error(strerror(errno));
+  return CpuSet(set);
+}
+
+// name of the calling thread as shown by top -H, ps -L and /proc;
+// the kernel keeps 15 bytes, the rest is cut off
+inline void SetName(std::string_view name) {
+  char buf[16];
+  auto n = std::min(name.size(), sizeof buf - 1);
+  memcpy(buf, name.data(), n);
+  buf[n] = '\0';
+  int res = pthread_setname_np(pthread_self(), buf);
+  if (res != 0)
+    throw std::runtime_error(strerror(res));
+}
+
+inline std::string GetName() {
+  char buf[16];
+  int res = pthread_getname_np(pthread_self(), buf, sizeof buf);
+  if (res != 0)
+    throw std::runtime_error(strerror(res));
+  return buf;
+}
+
+// where the calling thread runs right now, stale as soon as it's returned
+// unless the thread is pinned to one CPU
+inline int CurrentCpu() {
+  unsigned cpu = 0;
+  if (syscall(SYS_getcpu, &cpu, nullptr, nullptr) == -1)
+    throw std::runtime_error(strerror(errno));
+  return static_cast<int>(cpu);
+}
+
+inline int CurrentNode() {
+  unsigned node = 0;
+  if (syscall(SYS_getcpu, nullptr, &node, nullptr) == -1)
+    throw std::runtime_error(strerror(errno));
+  return static_cast<int>(node);
+}
+
+// online NUMA nodes; {0} on kernels without NUMA support
+inline std::vector<int> NumaNodes() {
+  try {
+    return CpuSet::Parse(
+               detail::readSysFile("/sys/devices/system/node/online"))
+        .Cpus();
+  } catch (std::runtime_error const &) {
+    return {0};
+  }
+}
+
+// the node a CPU belongs to, 0 without NUMA support
+inline int NodeOfCpu(int cpu) {
+  for (int node : NumaNodes()) {
+    try {
+      if (CpuSet::OfNode(node).Contains(cpu))
+        return node;
+    } catch (std::runtime_error const &) {
+    }
+  }
+  return 0;
+}
+
+enum class MemoryPolicy : int {
+  // the process default, usually the node of the CPU that faults the page
+  DEFAULT = MPOL_DEFAULT,
+  // the given nodes first, others when they are full
+  PREFERRED = MPOL_PREFERRED,
+  // only the given nodes, allocation fails (OOM) when they are full
+  BIND = MPOL_BIND,
+  // pages spread round robin over the nodes
+  INTERLEAVE = MPOL_INTERLEAVE,
+};
+
+namespace detail {
+
+// nodemask in the layout set_mempolicy()/mbind() expect, plus maxnode
+inline std::vector<unsigned long> nodeMask(std::vector<int> const &nodes,
+                                           unsigned long &maxnode) {
+  constexpr int BITS = sizeof(unsigned long) * 8;
+  int highest = -1;
+  for (int node : nodes)
+    highest = std::max(highest, node);
+  std::vector<unsigned long> mask(highest / BITS + 1, 0);
+  for (int node : nodes)
+    if (node >= 0)
+      mask[node / BITS] |= 1UL << (node % BITS);
+  // the kernel reads maxnode - 1 bits
+  maxnode = mask.size() * BITS + 1;
+  return mask;
+}
+
+} // namespace detail
+
+// policy for the calling thread's future page allocations (heap, stacks,
+// mmap), pages already faulted in stay where they are
+// nodes is ignored for DEFAULT
+inline void SetMemoryPolicy(MemoryPolicy policy,
+                            std::vector<int> const &nodes = {}) {
+  unsigned long maxnode = 0;
+  auto mask = detail::nodeMask(nodes, maxnode);
+  bool none = policy == MemoryPolicy::DEFAULT;
+  if (syscall(SYS_set_mempolicy, static_cast<int>(policy),
+              none ? nullptr : mask.data(), none ? 0 : maxnode) == -1)
+    throw std::runtime_error(strerror(errno));
+}
+
+// policy for a page-aligned range, e.g. a buffer allocated by one thread
+// for another; move also migrates pages already faulted in
+inline void BindMemory(void *addr, std::size_t length, MemoryPolicy policy,
+                       std::vector<int> const &nodes, bool move = false) {
+  unsigned long maxnode = 0;
+  auto mask = detail::nodeMask(nodes, maxnode);
+  bool none = policy == MemoryPolicy::DEFAULT;
+  if (syscall(SYS_mbind, addr, length, static_cast<int>(policy),
+              none ? nullptr : mask.data(), none ? 0 : maxnode,
+              move ? MPOL_MF_MOVE : 0) == -1)
+    throw std::runtime_error(strerror(errno));
+}
+
+// where a library-owned thread runs and allocates, applied by the thread
+// itself before it does anything else
+//
+// typical split: reactors pinned one per core, workers and the logger on
+// CpuSet::Available() - reactorCpus so they never preempt a loop
+struct Placement {
+  static constexpr int ANY_NODE = -1;
+  // the node of the CPU the thread runs on once placed
+  static constexpr int LOCAL_NODE = -2;
+
+  // thread name; threads started together get "name/<index>"
+  std::string name{};
+  // allowed CPUs, empty leaves the affinity alone
+  CpuSet cpus{};
+  // threads started together take one CPU of cpus each, round robin,
+  // instead of sharing all of them
+  bool spread{false};
+  // node for the thread's memory, ANY_NODE sets no policy
+  int memoryNode{ANY_NODE};
+  // BIND instead of PREFERRED: fail rather than spill to another node
+  bool strictMemory{false};
+
+  // place the calling thread, index is its position among the threads
+  // started with this placement
+  void Apply(std::size_t index = 0, bool numbered = false) const {
+    if (!name.empty())
+      SetName(numbered ? name + "/" + std::to_string(index) : name);
+    if (!cpus.Empty())
+      SetAffinity(spread ? CpuSet::Of(cpus.Nth(index)) : cpus);
+    if (memoryNode != ANY_NODE) {
+      int node = memoryNode == LOCAL_NODE ? CurrentNode() : memoryNode;
+      SetMemoryPolicy(strictMemory ? MemoryPolicy::BIND
+                                   : MemoryPolicy::PREFERRED,
+                      {node});
+    }
+  }
+};
+
+// start a thread that applies placement, then runs f
+// a placement failure (e.g. a CPU outside the cgroup) is not fatal, the
+// thread runs unplaced
+template <class F>
+std::thread Start(Placement placement, F &&f, std::size_t index = 0,
+                  bool numbered = false) {
+  return std::thread([placement = std::move(placement), index, numbered,
+                      f = std::forward<F>(f)]() mutable {
+    try {
+      placement.Apply(index, numbered);
+    } catch (std::runtime_error const &) {
+    }
+    f();
+  });
+}
 
-namespace THREAD {}
+} // namespace THREAD
 
 #endif
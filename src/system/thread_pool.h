@@ -0,0 +1,474 @@
+#ifndef SINO_THREAD_POOL_H
+#define SINO_THREAD_POOL_H
+
+// fixed size work-stealing thread pool
+//
+// every worker owns a Chase-Lev deque: it pushes and pops its own tasks at
+// the bottom without locks, idle workers steal from the top of the others;
+// tasks submitted from outside the pool go through one injection queue
+// idle workers spin briefly, then park on a futex instead of burning CPU
+//
+// Submit() returns a Future (one allocation, futex wait, no mutex);
+// TaskGroup collects tasks and Wait()s for all of them
+// a worker waiting on a Future or TaskGroup runs other tasks meanwhile, so
+// nested waits can't deadlock the pool
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "system/futex.h"
+#include "system/thread.h"
+
+namespace THREAD {
+
+// Chase-Lev deque ("Correct and Efficient Work-Stealing for Weak Memory
+// Models", Le et al. 2013) of pointers
+// Push/Pop by the owner only, Steal from any thread
+template <class T> class WorkStealingDeque {
+  static_assert(std::is_pointer_v<T>, "deque of pointers");
+
+private:
+  struct Array {
+    int64_t capacity;
+    std::unique_ptr<std::atomic<T>[]> slots;
+
+    explicit Array(int64_t cap)
+        : capacity(cap), slots(new std::atomic<T>[cap]) {}
+    T Get(int64_t i) const {
+      return slots[i & (capacity - 1)].load(std::memory_order_relaxed);
+    }
+    void Put(int64_t i, T value) {
+      slots[i & (capacity - 1)].store(value, std::memory_order_relaxed);
+    }
+  };
+
+  alignas(64) std::atomic<int64_t> _top{0};
+  alignas(64) std::atomic<int64_t> _bottom{0};
+  std::atomic<Array *> _array;
+  // arrays replaced by a grow may still be read by a thief, freed with
+  // the deque
+  std::vector<std::unique_ptr<Array>> _arrays{};
+
+public:
+  explicit WorkStealingDeque(int64_t capacity = 256) {
+    int64_t cap = 1;
+    while (cap < capacity)
+      cap <<= 1;
+    _arrays.emplace_back(new Array(cap));
+    _array.store(_arrays.back().get(), std::memory_order_relaxed);
+  }
+
+  WorkStealingDeque(WorkStealingDeque const &) = delete;
+  void operator=(WorkStealingDeque const &) = delete;
+
+  void Push(T value) {
+    auto b = _bottom.load(std::memory_order_relaxed);
+    auto t = _top.load(std::memory_order_acquire);
+    auto a = _array.load(std::memory_order_relaxed);
+    if (b - t > a->capacity - 1) {
+      auto bigger = new Array(a->capacity * 2);
+      for (auto i = t; i < b; i++)
+        bigger->Put(i, a->Get(i));
+      _arrays.emplace_back(bigger);
+      _array.store(bigger, std::memory_order_release);
+      a = bigger;
+    }
+    a->Put(b, value);
+    _bottom.store(b + 1, std::memory_order_release);
+  }
+
+  // newest first, nullptr if empty
+  T Pop() {
+    auto b = _bottom.load(std::memory_order_relaxed) - 1;
+    auto a = _array.load(std::memory_order_relaxed);
+    _bottom.store(b, std::memory_order_seq_cst);
+    auto t = _top.load(std::memory_order_seq_cst);
+    if (t > b) {
+      _bottom.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    T value = a->Get(b);
+    if (t == b) {
+      // the last one, race the thieves for it
+      if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                        std::memory_order_relaxed))
+        value = nullptr;
+      _bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return value;
+  }
+
+  // oldest first, nullptr if empty or lost a race
+  T Steal() {
+    auto t = _top.load(std::memory_order_seq_cst);
+    auto b = _bottom.load(std::memory_order_seq_cst);
+    if (t >= b)
+      return nullptr;
+    auto a = _array.load(std::memory_order_acquire);
+    T value = a->Get(t);
+    if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed))
+      return nullptr;
+    return value;
+  }
+
+  bool Empty() const {
+    return _top.load(std::memory_order_seq_cst) >=
+           _bottom.load(std::memory_order_seq_cst);
+  }
+};
+
+class ThreadPool;
+
+namespace detail {
+
+struct Task {
+  virtual ~Task() = default;
+  virtual void Run() = 0;
+};
+
+template <class F> struct FunctionTask final : Task {
+  F function;
+  explicit FunctionTask(F &&f) : function(std::move(f)) {}
+  void Run() override { function(); }
+};
+
+// 0 pending, 1 done, 2 pending with a sleeping waiter
+class Completion {
+private:
+  std::atomic<uint32_t> _state{0};
+
+public:
+  bool Done() const { return _state.load(std::memory_order_acquire) == 1; }
+
+  void Set() {
+    if (_state.exchange(1, std::memory_order_acq_rel) == 2)
+      FutexWakeAll(_state);
+  }
+
+  // help pool (if any) while waiting
+  inline void Wait(ThreadPool *pool);
+};
+
+template <class T> struct FutureState {
+  Completion done{};
+  std::optional<T> value{};
+  std::exception_ptr error{};
+};
+
+template <> struct FutureState<void> {
+  Completion done{};
+  std::exception_ptr error{};
+};
+
+} // namespace detail
+
+template <class T> class Future {
+private:
+  std::shared_ptr<detail::FutureState<T>> _state{};
+  ThreadPool *_pool{nullptr};
+
+public:
+  Future() = default;
+  Future(std::shared_ptr<detail::FutureState<T>> state, ThreadPool *pool)
+      : _state(std::move(state)), _pool(pool) {}
+
+  bool Valid() const { return _state != nullptr; }
+  bool Ready() const { return _state->done.Done(); }
+
+  void Wait() const { _state->done.Wait(_pool); }
+
+  // rethrows the task's exception; the value is moved out, call once
+  T Get() {
+    Wait();
+    if (_state->error)
+      std::rethrow_exception(_state->error);
+    if constexpr (!std::is_void_v<T>)
+      return std::move(*_state->value);
+  }
+};
+
+class ThreadPool {
+private:
+  struct Worker {
+    WorkStealingDeque<detail::Task *> deque{};
+    std::thread thread{};
+  };
+
+  static inline thread_local ThreadPool *tls_pool{nullptr};
+  static inline thread_local std::size_t tls_index{0};
+
+  std::vector<std::unique_ptr<Worker>> _workers{};
+  std::mutex _inject_mutex{};
+  std::deque<detail::Task *> _inject{};
+  std::atomic<std::size_t> _inject_size{0};
+  // bumped on every wake-up, parked workers sleep on it
+  std::atomic<uint32_t> _epoch{0};
+  std::atomic<uint32_t> _sleepers{0};
+  std::atomic<bool> _stop{false};
+
+  detail::Task *popInject() {
+    if (_inject_size.load(std::memory_order_seq_cst) == 0)
+      return nullptr;
+    std::lock_guard<std::mutex> lock(_inject_mutex);
+    if (_inject.empty())
+      return nullptr;
+    auto task = _inject.front();
+    _inject.pop_front();
+    _inject_size.fetch_sub(1, std::memory_order_relaxed);
+    return task;
+  }
+
+  // own deque, then the injection queue, then the others round robin
+  detail::Task *findTask() {
+    bool inside = tls_pool == this;
+    if (inside) {
+      if (auto task = _workers[tls_index]->deque.Pop())
+        return task;
+    }
+    if (auto task = popInject())
+      return task;
+    auto n = _workers.size();
+    auto start = inside ? tls_index + 1 : 0;
+    for (std::size_t i = 0; i < n; i++) {
+      auto victim = (start + i) % n;
+      if (inside && victim == tls_index)
+        continue;
+      if (auto task = _workers[victim]->deque.Steal())
+        return task;
+    }
+    return nullptr;
+  }
+
+  bool hasWork() const {
+    if (_inject_size.load(std::memory_order_seq_cst) > 0)
+      return true;
+    for (auto &w : _workers)
+      if (!w->deque.Empty())
+        return true;
+    return false;
+  }
+
+  static void run(detail::Task *task) {
+    task->Run();
+    delete task;
+  }
+
+  void wake() {
+    // pairs with the sleeper count update in park()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_sleepers.load(std::memory_order_seq_cst) > 0) {
+      _epoch.fetch_add(1, std::memory_order_seq_cst);
+      FutexWake(_epoch, 1);
+    }
+  }
+
+  void park() {
+    auto epoch = _epoch.load(std::memory_order_seq_cst);
+    _sleepers.fetch_add(1, std::memory_order_seq_cst);
+    if (!hasWork() && !_stop.load(std::memory_order_seq_cst))
+      FutexWait(_epoch, epoch);
+    _sleepers.fetch_sub(1, std::memory_order_seq_cst);
+  }
+
+  void workerLoop(std::size_t index) {
+    tls_pool = this;
+    tls_index = index;
+    while (true) {
+      if (auto task = findTask()) {
+        run(task);
+        continue;
+      }
+      // a short spin catches tasks submitted right behind the last one
+      bool found = false;
+      for (int i = 0; i < 64 && !found; i++) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+        found = hasWork();
+      }
+      if (found)
+        continue;
+      if (_stop.load(std::memory_order_seq_cst))
+        return;
+      park();
+    }
+  }
+
+  void submit(detail::Task *task) {
+    if (tls_pool == this) {
+      _workers[tls_index]->deque.Push(task);
+    } else {
+      std::lock_guard<std::mutex> lock(_inject_mutex);
+      _inject.push_back(task);
+      _inject_size.fetch_add(1, std::memory_order_seq_cst);
+    }
+    wake();
+  }
+
+public:
+  // threads: 0 means one per CPU, of placement.cpus if it is set
+  // workers are named placement.name/<index>, "worker/<index>" by default
+  explicit ThreadPool(std::size_t threads = 0, Placement placement = {}) {
+    if (threads == 0)
+      threads = placement.cpus.Empty()
+                    ? std::max(1u, std::thread::hardware_concurrency())
+                    : placement.cpus.Count();
+    if (placement.name.empty())
+      placement.name = "worker";
+    for (std::size_t i = 0; i < threads; i++)
+      _workers.emplace_back(new Worker());
+    for (std::size_t i = 0; i < threads; i++)
+      _workers[i]->thread =
+          Start(placement, [this, i] { workerLoop(i); }, i, true);
+  }
+
+  // runs every task already submitted, then joins
+  ~ThreadPool() {
+    _stop.store(true, std::memory_order_seq_cst);
+    _epoch.fetch_add(1, std::memory_order_seq_cst);
+    FutexWakeAll(_epoch);
+    for (auto &w : _workers)
+      w->thread.join();
+  }
+
+  ThreadPool(ThreadPool const &) = delete;
+  void operator=(ThreadPool const &) = delete;
+
+  std::size_t Size() const { return _workers.size(); }
+
+  // the pool whose worker is calling, nullptr on any other thread (also
+  // while it helps through RunOne() or a wait)
+  static ThreadPool *Current() { return tls_pool; }
+
+  // fire and forget, an exception escaping f terminates like std::thread
+  template <class F> void Post(F &&f) {
+    using Fn = std::decay_t<F>;
+    submit(new detail::FunctionTask<Fn>(Fn(std::forward<F>(f))));
+  }
+
+  template <class F> auto Submit(F &&f) -> Future<std::invoke_result_t<F &>> {
+    using R = std::invoke_result_t<F &>;
+    auto state = std::make_shared<detail::FutureState<R>>();
+    Post([state, fn = std::decay_t<F>(std::forward<F>(f))]() mutable {
+      try {
+        if constexpr (std::is_void_v<R>)
+          fn();
+        else
+          state->value.emplace(fn());
+      } catch (...) {
+        state->error = std::current_exception();
+      }
+      state->done.Set();
+    });
+    return Future<R>(std::move(state), this);
+  }
+
+  // run one pending task on the calling thread, false if none was found
+  bool RunOne() {
+    if (auto task = findTask()) {
+      run(task);
+      return true;
+    }
+    return false;
+  }
+};
+
+// tasks spawned together, Wait() returns when all of them finished and
+// rethrows the first exception; destruction waits as well
+class TaskGroup {
+private:
+  // shared with the tasks, the last one may still be waking the waiter
+  // while the group is already gone
+  struct State {
+    std::atomic<std::size_t> pending{0};
+    std::atomic<uint32_t> generation{0};
+    std::mutex error_mutex{};
+    std::exception_ptr error{};
+  };
+
+  ThreadPool &_pool;
+  std::shared_ptr<State> _state{std::make_shared<State>()};
+
+public:
+  explicit TaskGroup(ThreadPool &pool) : _pool(pool) {}
+
+  ~TaskGroup() {
+    try {
+      Wait();
+    } catch (...) {
+    }
+  }
+
+  TaskGroup(TaskGroup const &) = delete;
+  void operator=(TaskGroup const &) = delete;
+
+  template <class F> void Run(F &&f) {
+    _state->pending.fetch_add(1, std::memory_order_relaxed);
+    _pool.Post([state = _state,
+                fn = std::decay_t<F>(std::forward<F>(f))]() mutable {
+      try {
+        fn();
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(state->error_mutex);
+        if (!state->error)
+          state->error = std::current_exception();
+      }
+      if (state->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        state->generation.fetch_add(1, std::memory_order_release);
+        FutexWakeAll(state->generation);
+      }
+    });
+  }
+
+  void Wait() {
+    auto &state = *_state;
+    while (state.pending.load(std::memory_order_acquire) != 0) {
+      // help with the remaining tasks (or anything else queued)
+      if (_pool.RunOne())
+        continue;
+      // nothing left to steal, the rest is running on other threads
+      auto generation = state.generation.load(std::memory_order_acquire);
+      if (state.pending.load(std::memory_order_acquire) == 0)
+        break;
+      FutexWait(state.generation, generation, std::chrono::milliseconds(1));
+    }
+    std::lock_guard<std::mutex> lock(state.error_mutex);
+    if (state.error) {
+      auto error = state.error;
+      state.error = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+};
+
+namespace detail {
+
+inline void Completion::Wait(ThreadPool *pool) {
+  while (!Done()) {
+    if (pool != nullptr && pool->RunOne())
+      continue;
+    uint32_t expected = 0;
+    if (_state.compare_exchange_strong(expected, 2,
+                                       std::memory_order_acq_rel) ||
+        expected == 2) {
+      // sleep briefly, tasks submitted meanwhile may need our help
+      FutexWait(_state, 2, std::chrono::milliseconds(pool ? 1 : 1000));
+    }
+  }
+}
+
+} // namespace detail
+
+} // namespace THREAD
+
+#endif
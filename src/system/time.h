@@ -0,0 +1,764 @@
+#ifndef SINO_TIME_H
+#define SINO_TIME_H
+
+// clock_gettime() CLOCK_REALTIME CLOCK_MONOTONIC CLOCK_*_COARSE
+#include <ctime>
+// open() read() close()
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+// __rdtsc() __cpuid()
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "general/inc_exception.h"
+
+namespace TIME {
+
+int64_t constexpr NS_PER_SEC = 1000000000;
+
+// nanoseconds of the given clock
+// CLOCK_*_COARSE only costs a vDSO load, resolution is one tick (1-4ms)
+inline int64_t Now(clockid_t clock) noexcept {
+  struct timespec ts {};
+  clock_gettime(clock, &ts);
+  return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+inline int64_t RealtimeNs() noexcept { return Now(CLOCK_REALTIME); }
+inline int64_t MonotonicNs() noexcept { return Now(CLOCK_MONOTONIC); }
+inline int64_t CoarseRealtimeNs() noexcept {
+  return Now(CLOCK_REALTIME_COARSE);
+}
+inline int64_t CoarseMonotonicNs() noexcept {
+  return Now(CLOCK_MONOTONIC_COARSE);
+}
+
+// clock cached by an event loop
+// Refresh() once per iteration, everything handled in that iteration
+// reads the same instant without a syscall
+class LoopClock final {
+private:
+  int64_t _realtime{};
+  int64_t _monotonic{};
+
+public:
+  LoopClock() noexcept { Refresh(); }
+
+  void Refresh() noexcept {
+    _realtime = CoarseRealtimeNs();
+    _monotonic = CoarseMonotonicNs();
+  }
+
+  int64_t Realtime() const noexcept { return _realtime; }
+  int64_t Monotonic() const noexcept { return _monotonic; }
+  time_t Seconds() const noexcept { return _realtime / NS_PER_SEC; }
+};
+
+// CLOCK_MONOTONIC scaled from the time stamp counter
+// only used when the TSC is invariant (constant rate, keeps running in
+// deep C-states), otherwise Monotonic() falls back to clock_gettime()
+// one calibration is never exact, so the first reader past ANCHOR_NS
+// re-anchors it on CLOCK_MONOTONIC: the rate is measured again over the
+// whole period and the error is slewed out over the next one, time doesn't
+// step back unless it was off by half a period (e.g. after a suspend)
+// the anchor is published under a seqlock, readers never block; a reader
+// racing a re-anchor uses clock_gettime()
+class TscClock final {
+private:
+  static constexpr int64_t ANCHOR_NS = NS_PER_SEC;
+
+  // odd while the anchor is rewritten
+  static inline std::atomic<uint32_t> _seq{0};
+  static inline std::atomic<uint64_t> _base_ticks{0};
+  static inline std::atomic<int64_t> _base_ns{0};
+  // ns per tick, 32.32 fixed point, 0 until calibrated
+  static inline std::atomic<uint64_t> _mult{0};
+  // the first reader at or past it re-anchors
+  static inline std::atomic<uint64_t> _refresh_at{0};
+  // writer only, the last ticks/ns pair read together
+  static inline uint64_t _measured_ticks{0};
+  static inline int64_t _measured_ns{0};
+
+  static int64_t scale(uint64_t ticks, uint64_t base_ticks, int64_t base_ns,
+                       uint64_t mult) noexcept {
+    // another CPU may read a few ticks behind the one that anchored
+    auto delta = static_cast<int64_t>(ticks - base_ticks);
+    if (delta < 0)
+      delta = 0;
+    return base_ns +
+           static_cast<int64_t>((static_cast<unsigned __int128>(delta) * mult) >>
+                                32);
+  }
+
+  static uint64_t rate(uint64_t t0, int64_t ns0, uint64_t t1, int64_t ns1) {
+    return static_cast<uint64_t>(
+        (static_cast<unsigned __int128>(ns1 - ns0) << 32) / (t1 - t0));
+  }
+
+  // only from the even seq the caller read the anchor at
+  static bool lock(uint32_t seq) noexcept {
+    if ((seq & 1) != 0 ||
+        !_seq.compare_exchange_strong(seq, seq + 1, std::memory_order_relaxed))
+      return false;
+    std::atomic_thread_fence(std::memory_order_release);
+    return true;
+  }
+
+  // t and ns were read together, they measure the next period's rate
+  static void publish(uint32_t seq, uint64_t base_ticks, int64_t base_ns,
+                      uint64_t mult, uint64_t t, int64_t ns) noexcept {
+    _base_ticks.store(base_ticks, std::memory_order_relaxed);
+    _base_ns.store(base_ns, std::memory_order_relaxed);
+    _mult.store(mult, std::memory_order_relaxed);
+    _refresh_at.store(
+        base_ticks + static_cast<uint64_t>(
+                         (static_cast<unsigned __int128>(ANCHOR_NS) << 32) /
+                         mult),
+        std::memory_order_relaxed);
+    _measured_ticks = t;
+    _measured_ns = ns;
+    _seq.store(seq + 2, std::memory_order_release);
+  }
+
+  // seq is the one the expired anchor was read at, a reader that lost the
+  // race to another one falls back to clock_gettime()
+  static int64_t reanchor(uint32_t seq) noexcept {
+    if (!lock(seq))
+      return MonotonicNs();
+    auto t = Ticks();
+    auto ns = MonotonicNs();
+    auto base_ticks = _base_ticks.load(std::memory_order_relaxed);
+    auto refresh_at = _refresh_at.load(std::memory_order_relaxed);
+    auto old = _mult.load(std::memory_order_relaxed);
+    auto mult = old;
+    if (t > _measured_ticks && ns > _measured_ns)
+      mult = rate(_measured_ticks, _measured_ns, t, ns);
+    auto now =
+        scale(t, base_ticks, _base_ns.load(std::memory_order_relaxed), old);
+    auto err = ns - now;
+    // left unread for more than a period: nobody saw the drifted values
+    bool stale = t - refresh_at > refresh_at - base_ticks;
+    if (stale || err <= -ANCHOR_NS / 2 || err >= ANCHOR_NS / 2) {
+      publish(seq, t, ns, mult, t, ns);
+      return ns;
+    }
+    // reach the true time one period from now
+    auto slewed = static_cast<unsigned __int128>(mult) * (ANCHOR_NS + err) /
+                  ANCHOR_NS;
+    publish(seq, t, now, static_cast<uint64_t>(slewed), t, ns);
+    return now;
+  }
+
+public:
+  static bool Available() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned eax, ebx, ecx, edx;
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 ||
+        eax < 0x80000007)
+      return false;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx & (1u << 8)) != 0;
+#else
+    return false;
+#endif
+  }
+
+  static uint64_t Ticks() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(MonotonicNs());
+#endif
+  }
+
+  // measure the tick rate against CLOCK_MONOTONIC over window
+  // return false (and keep using clock_gettime) if the TSC is unusable
+  static bool Calibrate(std::chrono::milliseconds window =
+                            std::chrono::milliseconds(20)) {
+    if (!Available())
+      return false;
+    auto t0 = Ticks();
+    auto ns0 = MonotonicNs();
+    auto sleep = std::chrono::duration_cast<std::chrono::nanoseconds>(window)
+                     .count();
+    struct timespec req {
+      static_cast<time_t>(sleep / NS_PER_SEC),
+          static_cast<long>(sleep % NS_PER_SEC)
+    };
+    while (nanosleep(&req, &req) == -1 && errno == EINTR) {
+    }
+    auto t1 = Ticks();
+    auto ns1 = MonotonicNs();
+    if (t1 <= t0 || ns1 <= ns0)
+      return false;
+    uint32_t seq;
+    do
+      seq = _seq.load(std::memory_order_relaxed);
+    while (!lock(seq));
+    publish(seq, t1, ns1, rate(t0, ns0, t1, ns1), t1, ns1);
+    return true;
+  }
+
+  static bool Calibrated() noexcept {
+    return _mult.load(std::memory_order_relaxed) != 0;
+  }
+
+  // nanoseconds on the CLOCK_MONOTONIC scale
+  static int64_t Monotonic() noexcept {
+    while (true) {
+      auto seq = _seq.load(std::memory_order_acquire);
+      if ((seq & 1) != 0)
+        return MonotonicNs();
+      auto base_ticks = _base_ticks.load(std::memory_order_relaxed);
+      auto base_ns = _base_ns.load(std::memory_order_relaxed);
+      auto mult = _mult.load(std::memory_order_relaxed);
+      auto refresh_at = _refresh_at.load(std::memory_order_relaxed);
+      auto t = Ticks();
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (_seq.load(std::memory_order_relaxed) != seq)
+        continue;
+      if (mult == 0)
+        return MonotonicNs();
+      if (t >= refresh_at)
+        return reanchor(seq);
+      return scale(t, base_ticks, base_ns, mult);
+    }
+  }
+};
+
+// broken down time, fields as in struct tm except year and month are not
+// offset (year 2022, month 1-12)
+struct CivilTime {
+  int year{1970};
+  int month{1};
+  int day{1};
+  int hour{};
+  int minute{};
+  int second{};
+  // 0 = Sunday
+  int weekday{4};
+  int32_t gmtoff{};
+  bool isdst{};
+};
+
+// days since 1970-01-01 to (y, m, d), proleptic Gregorian
+inline void CivilFromDays(int64_t days, int &year, int &month, int &day) {
+  days += 719468;
+  int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  int64_t doe = days - era * 146097;
+  int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  int64_t mp = (5 * doy + 2) / 153;
+  day = static_cast<int>(doy - (153 * mp + 2) / 5 + 1);
+  month = static_cast<int>(mp < 10 ? mp + 3 : mp - 9);
+  year = static_cast<int>(yoe + era * 400 + (month <= 2));
+}
+
+// (y, m, d) to days since 1970-01-01
+inline int64_t DaysFromCivil(int year, int month, int day) {
+  year -= month <= 2;
+  int64_t era = (year >= 0 ? year : year - 399) / 400;
+  int64_t yoe = year - era * 400;
+  int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+// seconds since epoch (already shifted by gmtoff) to civil time
+inline CivilTime BreakDown(int64_t seconds, int32_t gmtoff = 0,
+                           bool isdst = false) {
+  CivilTime res{};
+  int64_t local = seconds + gmtoff;
+  int64_t days = local >= 0 ? local / 86400 : (local - 86399) / 86400;
+  int64_t rem = local - days * 86400;
+  CivilFromDays(days, res.year, res.month, res.day);
+  res.hour = static_cast<int>(rem / 3600);
+  res.minute = static_cast<int>(rem % 3600 / 60);
+  res.second = static_cast<int>(rem % 60);
+  res.weekday = static_cast<int>(((days % 7) + 11) % 7);
+  res.gmtoff = gmtoff;
+  res.isdst = isdst;
+  return res;
+}
+
+// time zone rules loaded once from tzdata (TZif files) or a POSIX TZ
+// string, later conversions never touch the file system
+class TimeZone final {
+private:
+  struct LocalType {
+    int32_t gmtoff;
+    bool isdst;
+  };
+
+  // POSIX TZ rule, "CET-1CEST,M3.5.0,M10.5.0/3"
+  struct Rule {
+    enum Kind : uint8_t { JULIAN_NO_LEAP, JULIAN, MONTH_WEEK_DAY };
+    Kind kind{MONTH_WEEK_DAY};
+    int month{};
+    int week{};
+    int day{};
+    // seconds after local midnight
+    int32_t time{7200};
+  };
+
+  std::string _name{"UTC"};
+  std::vector<int64_t> _transitions{};
+  std::vector<uint8_t> _indices{};
+  std::vector<LocalType> _types{{0, false}};
+  bool _has_rule{false};
+  LocalType _std{0, false};
+  LocalType _dst{0, true};
+  bool _has_dst{false};
+  Rule _dst_start{};
+  Rule _dst_end{};
+
+  static uint32_t be32(unsigned char const *p) {
+    return (uint32_t{p[0]} << 24) | (uint32_t{p[1]} << 16) |
+           (uint32_t{p[2]} << 8) | p[3];
+  }
+  static int64_t be64(unsigned char const *p) {
+    return static_cast<int64_t>((uint64_t{be32(p)} << 32) | be32(p + 4));
+  }
+
+  static std::string readFile(std::string const &path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+      throw std::runtime_error(path + ": " + strerror(errno));
+    std::string res;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof buf)) > 0)
+      res.append(buf, n);
+    int err = errno;
+    close(fd);
+    if (n == -1)
+      throw std::runtime_error(path + ": " + strerror(err));
+    return res;
+  }
+
+  // [+-]hh[:mm[:ss]], returns seconds
+  static bool parseOffset(std::string_view &s, int32_t &res) {
+    int sign = 1;
+    if (!s.empty() && (s[0] == '+' || s[0] == '-')) {
+      sign = s[0] == '-' ? -1 : 1;
+      s.remove_prefix(1);
+    }
+    int32_t parts[3] = {0, 0, 0};
+    for (int i = 0; i < 3; i++) {
+      if (s.empty() || s[0] < '0' || s[0] > '9')
+        return i > 0;
+      int v = 0;
+      while (!s.empty() && s[0] >= '0' && s[0] <= '9') {
+        v = v * 10 + (s[0] - '0');
+        s.remove_prefix(1);
+      }
+      parts[i] = v;
+      res = sign * (parts[0] * 3600 + parts[1] * 60 + parts[2]);
+      if (s.empty() || s[0] != ':')
+        return true;
+      s.remove_prefix(1);
+    }
+    return true;
+  }
+
+  static bool parseAbbr(std::string_view &s) {
+    if (!s.empty() && s[0] == '<') {
+      auto close = s.find('>');
+      if (close == std::string_view::npos)
+        return false;
+      s.remove_prefix(close + 1);
+      return true;
+    }
+    std::size_t n = 0;
+    while (n < s.size() && ((s[n] >= 'A' && s[n] <= 'Z') ||
+                            (s[n] >= 'a' && s[n] <= 'z')))
+      n++;
+    s.remove_prefix(n);
+    return n >= 3;
+  }
+
+  static bool parseRule(std::string_view &s, Rule &rule) {
+    auto number = [&s](int &v) {
+      if (s.empty() || s[0] < '0' || s[0] > '9')
+        return false;
+      v = 0;
+      while (!s.empty() && s[0] >= '0' && s[0] <= '9') {
+        v = v * 10 + (s[0] - '0');
+        s.remove_prefix(1);
+      }
+      return true;
+    };
+    if (!s.empty() && s[0] == 'M') {
+      s.remove_prefix(1);
+      rule.kind = Rule::MONTH_WEEK_DAY;
+      if (!number(rule.month) || s.empty() || s[0] != '.')
+        return false;
+      s.remove_prefix(1);
+      if (!number(rule.week) || s.empty() || s[0] != '.')
+        return false;
+      s.remove_prefix(1);
+      if (!number(rule.day))
+        return false;
+    } else if (!s.empty() && s[0] == 'J') {
+      s.remove_prefix(1);
+      rule.kind = Rule::JULIAN_NO_LEAP;
+      if (!number(rule.day))
+        return false;
+    } else {
+      rule.kind = Rule::JULIAN;
+      if (!number(rule.day))
+        return false;
+    }
+    rule.time = 7200;
+    if (!s.empty() && s[0] == '/') {
+      s.remove_prefix(1);
+      if (!parseOffset(s, rule.time))
+        return false;
+    }
+    return true;
+  }
+
+  // POSIX offsets are west of Greenwich, gmtoff is east
+  bool parsePosix(std::string_view s) {
+    if (!parseAbbr(s))
+      return false;
+    int32_t west = 0;
+    if (!parseOffset(s, west))
+      return false;
+    _std = {-west, false};
+    _has_rule = true;
+    if (s.empty())
+      return true;
+    if (!parseAbbr(s))
+      return false;
+    _dst = {_std.gmtoff + 3600, true};
+    if (!s.empty() && s[0] != ',') {
+      if (!parseOffset(s, west))
+        return false;
+      _dst.gmtoff = -west;
+    }
+    if (s.empty()) {
+      // no rule given, the POSIX default is the US one
+      std::string_view us(",M3.2.0,M11.1.0");
+      return parseRules(us);
+    }
+    return parseRules(s);
+  }
+
+  bool parseRules(std::string_view &s) {
+    if (s.empty() || s[0] != ',')
+      return false;
+    s.remove_prefix(1);
+    if (!parseRule(s, _dst_start) || s.empty() || s[0] != ',')
+      return false;
+    s.remove_prefix(1);
+    if (!parseRule(s, _dst_end))
+      return false;
+    _has_dst = true;
+    return s.empty();
+  }
+
+  // local seconds since epoch at which rule fires in year (before time offset)
+  static int64_t ruleDay(Rule const &rule, int year) {
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    int64_t jan1 = DaysFromCivil(year, 1, 1);
+    switch (rule.kind) {
+    case Rule::JULIAN_NO_LEAP:
+      return jan1 + rule.day - 1 + (leap && rule.day >= 60);
+    case Rule::JULIAN:
+      return jan1 + rule.day;
+    case Rule::MONTH_WEEK_DAY:
+    default: {
+      int64_t first = DaysFromCivil(year, rule.month, 1);
+      int wday = static_cast<int>(((first % 7) + 11) % 7);
+      int64_t day = first + (rule.day - wday + 7) % 7 + (rule.week - 1) * 7;
+      if (rule.week == 5) {
+        static int const mdays[] = {31, 28, 31, 30, 31, 30,
+                                    31, 31, 30, 31, 30, 31};
+        int len = mdays[rule.month - 1] + (rule.month == 2 && leap);
+        while (day >= first + len)
+          day -= 7;
+      }
+      return day;
+    }
+    }
+  }
+
+  LocalType ruleType(int64_t utc) const {
+    if (!_has_dst)
+      return _std;
+    int year = BreakDown(utc, _std.gmtoff).year;
+    // like glibc, a bare rule has no daylight saving before 1970
+    if (year < 1970)
+      return _std;
+    // start is given in standard time, end in daylight time
+    int64_t start =
+        ruleDay(_dst_start, year) * 86400 + _dst_start.time - _std.gmtoff;
+    int64_t end =
+        ruleDay(_dst_end, year) * 86400 + _dst_end.time - _dst.gmtoff;
+    bool dst = start < end ? (utc >= start && utc < end)
+                           : !(utc >= end && utc < start);
+    return dst ? _dst : _std;
+  }
+
+  bool parseTZif(std::string const &data) {
+    auto p = reinterpret_cast<unsigned char const *>(data.data());
+    auto end = p + data.size();
+    if (data.size() < 44 || data.compare(0, 4, "TZif") != 0)
+      return false;
+
+    char version = data[4];
+    int time_size = 4;
+    // version 2+ repeats the data with 64-bit times after the v1 block
+    for (int pass = 0; pass < 2; pass++) {
+      if (end - p < 44)
+        return false;
+      uint32_t isutcnt = be32(p + 20), isstdcnt = be32(p + 24),
+               leapcnt = be32(p + 28), timecnt = be32(p + 32),
+               typecnt = be32(p + 36), charcnt = be32(p + 40);
+      p += 44;
+      std::size_t len = timecnt * time_size + timecnt + typecnt * 6 +
+                        charcnt + leapcnt * (time_size + 4) + isstdcnt +
+                        isutcnt;
+      if (static_cast<std::size_t>(end - p) < len || typecnt == 0)
+        return false;
+      if (pass == 0 && version >= '2') {
+        p += len;
+        time_size = 8;
+        continue;
+      }
+
+      _transitions.resize(timecnt);
+      for (uint32_t i = 0; i < timecnt; i++, p += time_size)
+        _transitions[i] = time_size == 8
+                              ? be64(p)
+                              : static_cast<int32_t>(be32(p));
+      _indices.assign(p, p + timecnt);
+      p += timecnt;
+      _types.resize(typecnt);
+      for (uint32_t i = 0; i < typecnt; i++, p += 6)
+        _types[i] = {static_cast<int32_t>(be32(p)), p[4] != 0};
+      for (auto idx : _indices)
+        if (idx >= typecnt)
+          return false;
+      p += charcnt + leapcnt * (time_size + 4) + isstdcnt + isutcnt;
+      break;
+    }
+
+    // footer: "\n<POSIX TZ>\n", rules for times past the last transition
+    if (time_size == 8 && end - p > 2 && *p == '\n') {
+      auto nl = std::find(p + 1, end, '\n');
+      if (nl != end && nl > p + 1)
+        parsePosix(std::string_view(reinterpret_cast<char const *>(p + 1),
+                                    nl - p - 1));
+    }
+    return true;
+  }
+
+  LocalType lookup(int64_t utc) const {
+    if (_transitions.empty() || utc >= _transitions.back()) {
+      if (_has_rule)
+        return ruleType(utc);
+      if (_transitions.empty()) {
+        // no transition at all, the first non-dst type applies
+        for (auto &t : _types)
+          if (!t.isdst)
+            return t;
+        return _types[0];
+      }
+      return _types[_indices.back()];
+    }
+    if (utc < _transitions.front()) {
+      for (auto &t : _types)
+        if (!t.isdst)
+          return t;
+      return _types[0];
+    }
+    auto it =
+        std::upper_bound(_transitions.begin(), _transitions.end(), utc);
+    return _types[_indices[it - _transitions.begin() - 1]];
+  }
+
+public:
+  static TimeZone UTC() { return TimeZone{}; }
+
+  // offset east of UTC in seconds
+  static TimeZone Fixed(int32_t gmtoff, std::string name = {}) {
+    TimeZone res{};
+    res._types = {{gmtoff, false}};
+    res._name = name.empty() ? "UTC" + std::to_string(gmtoff) : name;
+    return res;
+  }
+
+  // name: "Asia/Shanghai" (looked up in /usr/share/zoneinfo), an absolute
+  //   TZif path, or a POSIX TZ string such as "CST-8"
+  // throw runtime_error if nothing matches
+  static TimeZone Load(std::string const &name) {
+    TimeZone res{};
+    res._name = name;
+    std::string path = name;
+    if (!path.empty() && path[0] == ':')
+      path.erase(0, 1);
+    if (path.empty() || path[0] != '/')
+      path = "/usr/share/zoneinfo/" + path;
+    if (access(path.c_str(), R_OK) == 0) {
+      if (res.parseTZif(readFile(path)))
+        return res;
+      throw std::runtime_error(path + ": not a TZif file");
+    }
+    if (res.parsePosix(name))
+      return res;
+    throw std::runtime_error("unknown time zone: " + name);
+  }
+
+  // $TZ, else /etc/localtime, else UTC; loaded on first use only
+  static TimeZone const &Local() {
+    static TimeZone const local = [] {
+      try {
+        char const *tz = getenv("TZ");
+        if (tz != nullptr && *tz != '\0')
+          return Load(tz);
+        auto res = Load("/etc/localtime");
+        res._name = "localtime";
+        return res;
+      } catch (std::exception const &) {
+        return UTC();
+      }
+    }();
+    return local;
+  }
+
+  std::string const &Name() const noexcept { return _name; }
+
+  // seconds east of UTC in effect at utc (seconds since epoch)
+  int32_t Offset(int64_t utc) const { return lookup(utc).gmtoff; }
+
+  CivilTime ToLocal(int64_t utc) const {
+    auto t = lookup(utc);
+    return BreakDown(utc, t.gmtoff, t.isdst);
+  }
+};
+
+inline void put2(char *p, int v) {
+  p[0] = static_cast<char>('0' + v / 10);
+  p[1] = static_cast<char>('0' + v % 10);
+}
+
+// per-thread cache of "YYYY-mm-dd HH:MM:SS", rebuilt only when the second
+// changes, the sub-second part is appended with a few stores
+class DateTimeCache final {
+private:
+  TimeZone const *_zone;
+  int64_t _second{std::numeric_limits<int64_t>::min()};
+  char _text[20]{};
+
+  void rebuild(int64_t second) {
+    auto t = _zone->ToLocal(second);
+    auto p = _text;
+    put2(p, t.year / 100);
+    put2(p + 2, t.year % 100);
+    p[4] = '-';
+    put2(p + 5, t.month);
+    p[7] = '-';
+    put2(p + 8, t.day);
+    p[10] = ' ';
+    put2(p + 11, t.hour);
+    p[13] = ':';
+    put2(p + 14, t.minute);
+    p[16] = ':';
+    put2(p + 17, t.second);
+    _second = second;
+  }
+
+public:
+  static std::size_t constexpr SECONDS_SIZE = 19;
+  static std::size_t constexpr MICROS_SIZE = 26;
+
+  explicit DateTimeCache(TimeZone const &zone = TimeZone::Local())
+      : _zone(&zone) {}
+
+  static DateTimeCache &ThisThread() {
+    thread_local DateTimeCache cache{};
+    return cache;
+  }
+
+  // "2022-03-23 12:00:00"
+  std::string_view Seconds(int64_t realtime_ns) {
+    int64_t second = realtime_ns / NS_PER_SEC;
+    if (second != _second)
+      rebuild(second);
+    return std::string_view(_text, SECONDS_SIZE);
+  }
+
+  // "2022-03-23 12:00:00.123456" into out, which needs MICROS_SIZE bytes
+  std::size_t Micros(char *out, int64_t realtime_ns) {
+    auto s = Seconds(realtime_ns);
+    std::copy(s.begin(), s.end(), out);
+    int us = static_cast<int>(realtime_ns % NS_PER_SEC / 1000);
+    out[19] = '.';
+    for (int i = 25; i > 19; i--, us /= 10)
+      out[i] = static_cast<char>('0' + us % 10);
+    return MICROS_SIZE;
+  }
+};
+
+// per-thread cache of the HTTP Date header value (RFC 7231 IMF-fixdate)
+// "Sun, 06 Nov 1994 08:49:37 GMT", rebuilt once per second
+class HttpDateCache final {
+private:
+  int64_t _second{std::numeric_limits<int64_t>::min()};
+  char _text[29]{};
+
+public:
+  static HttpDateCache &ThisThread() {
+    thread_local HttpDateCache cache{};
+    return cache;
+  }
+
+  std::string_view Format(int64_t realtime_ns) {
+    int64_t second = realtime_ns / NS_PER_SEC;
+    if (second != _second) {
+      static char const days[][4] = {"Sun", "Mon", "Tue", "Wed",
+                                     "Thu", "Fri", "Sat"};
+      static char const months[][4] = {"Jan", "Feb", "Mar", "Apr",
+                                       "May", "Jun", "Jul", "Aug",
+                                       "Sep", "Oct", "Nov", "Dec"};
+      auto t = BreakDown(second);
+      auto p = _text;
+      std::copy(days[t.weekday], days[t.weekday] + 3, p);
+      p[3] = ',';
+      p[4] = ' ';
+      put2(p + 5, t.day);
+      p[7] = ' ';
+      std::copy(months[t.month - 1], months[t.month - 1] + 3, p + 8);
+      p[11] = ' ';
+      put2(p + 12, t.year / 100);
+      put2(p + 14, t.year % 100);
+      p[16] = ' ';
+      put2(p + 17, t.hour);
+      p[19] = ':';
+      put2(p + 20, t.minute);
+      p[22] = ':';
+      put2(p + 23, t.second);
+      std::copy(" GMT", " GMT" + 4, p + 25);
+      _second = second;
+    }
+    return std::string_view(_text, sizeof _text);
+  }
+};
+
+} // namespace TIME
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef BUFFERED_IO_H
+#define BUFFERED_IO_H
+
+// buffered stream layer over FS
+//
+// BufferedReader fills one large buffer per read() and hands out records as
+// string_views into it, split with memchr (glibc's is SSE2/AVX2 vectorised,
+// so scanning runs at memory bandwidth); a view stays valid until the next
+// call on the reader, nothing is copied or allocated per record
+//
+// BufferedWriter gathers small writes into one buffer and writes it out in
+// one call; a write bigger than the buffer goes out together with the
+// buffered bytes in one writev()
+
+#include "fs_wrap.h"
+
+#include <sys/uio.h>
+
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+class BufferedReader {
+private:
+    FD &_fd;
+    std::unique_ptr<char[]> _buffer;
+    std::size_t _capacity;
+    // unread bytes are [_begin, _end)
+    std::size_t _begin{0};
+    std::size_t _end{0};
+    bool _eof{false};
+
+    // keep the unread bytes, make room behind them and read once
+    // the buffer doubles when one record doesn't fit into it
+    void refill() {
+        if (_begin > 0) {
+            std::memmove(_buffer.get(), _buffer.get() + _begin, _end - _begin);
+            _end -= _begin;
+            _begin = 0;
+        }
+        if (_end == _capacity) {
+            auto bigger = std::unique_ptr<char[]>(new char[_capacity * 2]);
+            std::memcpy(bigger.get(), _buffer.get(), _end);
+            _buffer = std::move(bigger);
+            _capacity *= 2;
+        }
+        auto n = FS::Read(_fd, _buffer.get() + _end, _capacity - _end);
+        if (n == 0)
+            _eof = true;
+        _end += n;
+    }
+
+public:
+    // fd must outlive the reader
+    explicit BufferedReader(FD &fd, std::size_t bufferSize = 1 << 20)
+            : _fd(fd), _buffer(new char[std::max<std::size_t>(bufferSize, 64)]),
+              _capacity(std::max<std::size_t>(bufferSize, 64)) {}
+
+    BufferedReader(BufferedReader const &) = delete;
+
+    void operator=(BufferedReader const &) = delete;
+
+    // the next record ending with delim, delim itself excluded
+    // the last record of the file may lack the delimiter
+    // false at end of file
+    bool Next(std::string_view &record, char delim = '\n') {
+        std::size_t scanned = _begin;
+        while (true) {
+            auto found = static_cast<char *>(
+                    std::memchr(_buffer.get() + scanned, delim, _end - scanned));
+            if (found != nullptr) {
+                auto pos = static_cast<std::size_t>(found - _buffer.get());
+                record = std::string_view(_buffer.get() + _begin, pos - _begin);
+                _begin = pos + 1;
+                return true;
+            }
+            if (_eof) {
+                if (_begin == _end)
+                    return false;
+                record = std::string_view(_buffer.get() + _begin, _end - _begin);
+                _begin = _end;
+                return true;
+            }
+            // don't scan the same bytes again after the refill moved them
+            scanned = _end - _begin;
+            refill();
+        }
+    }
+
+    // a line without its "\n" or "\r\n"
+    bool NextLine(std::string_view &line) {
+        if (!Next(line, '\n'))
+            return false;
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        return true;
+    }
+
+    // call f(record) for every remaining record
+    template<class F>
+    void ForEach(F &&f, char delim = '\n') {
+        std::string_view record;
+        while (Next(record, delim))
+            f(record);
+    }
+
+    // copy up to size raw bytes, short only at end of file
+    std::size_t Read(char *out, std::size_t size) {
+        std::size_t n = 0;
+        while (n < size) {
+            if (_begin == _end) {
+                if (_eof)
+                    break;
+                // large reads go straight into out
+                if (size - n >= _capacity) {
+                    auto res = FS::Read(_fd, out + n, size - n);
+                    if (res == 0)
+                        _eof = true;
+                    n += res;
+                    continue;
+                }
+                refill();
+                continue;
+            }
+            auto len = std::min(size - n, _end - _begin);
+            std::memcpy(out + n, _buffer.get() + _begin, len);
+            _begin += len;
+            n += len;
+        }
+        return n;
+    }
+};
+
+class BufferedWriter {
+private:
+    FD &_fd;
+    std::unique_ptr<char[]> _buffer;
+    std::size_t _capacity;
+    std::size_t _size{0};
+
+public:
+    // fd must outlive the writer
+    explicit BufferedWriter(FD &fd, std::size_t bufferSize = 1 << 20)
+            : _fd(fd), _buffer(new char[std::max<std::size_t>(bufferSize, 64)]),
+              _capacity(std::max<std::size_t>(bufferSize, 64)) {}
+
+    // errors can't be reported here, call Flush() first to see them
+    ~BufferedWriter() {
+        try {
+            Flush();
+        } catch (std::exception const &) {
+        }
+    }
+
+    BufferedWriter(BufferedWriter const &) = delete;
+
+    void operator=(BufferedWriter const &) = delete;
+
+    void Write(char const *data, std::size_t len) {
+        if (len <= _capacity - _size) {
+            std::memcpy(_buffer.get() + _size, data, len);
+            _size += len;
+            return;
+        }
+        if (len < _capacity) {
+            Flush();
+            std::memcpy(_buffer.get(), data, len);
+            _size = len;
+            return;
+        }
+        // too big to buffer, one writev() for both
+        struct iovec iov[2] = {{_buffer.get(), _size}, {const_cast<char *>(data), len}};
+        int first = _size == 0 ? 1 : 0;
+        FS::WriteV(_fd, iov + first, 2 - first);
+        _size = 0;
+    }
+
+    void Write(std::string_view s) { Write(s.data(), s.size()); }
+
+    void Put(char c) {
+        if (_size == _capacity)
+            Flush();
+        _buffer[_size++] = c;
+    }
+
+    // s followed by '\n'
+    void WriteLine(std::string_view s) {
+        Write(s);
+        Put('\n');
+    }
+
+    void Flush() {
+        if (_size == 0)
+            return;
+        struct iovec iov{_buffer.get(), _size};
+        FS::WriteV(_fd, &iov, 1);
+        _size = 0;
+    }
+};
+
+#endif //BUFFERED_IO_H
@@ -0,0 +1,257 @@
+#ifndef DIR_WALKER_H
+#define DIR_WALKER_H
+
+// parallel recursive directory walker
+//
+// entries are read with getdents64() into a large per-thread buffer that is
+// reused for every directory, subdirectories are opened with openat() relative
+// to their parent, and d_type spares a stat() per entry (fstatat() is only
+// called when the file system reports DT_UNKNOWN)
+//
+// every subdirectory becomes a task; each thread runs its own tasks newest
+// first (depth first, few fds open) and steals the oldest task of another
+// thread when it runs dry (big subtrees near the root move between threads)
+
+#include "fd_wrap.h"
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+class DirWalker {
+public:
+    struct Entry {
+        // path of the containing directory relative to the root, "" for the root itself
+        std::string_view dir;
+        std::string_view name;
+        // DT_REG, DT_DIR, DT_LNK, ...
+        unsigned char type;
+        ino_t inode;
+        // the containing directory, valid during the callback, for fstatat()/openat()
+        int dirFd;
+    };
+
+    // runs on any walker thread, concurrently
+    // for a directory, returning false skips its subtree; ignored for other entries
+    using Visitor = std::function<bool(Entry const &)>;
+
+private:
+    // open directory shared by the tasks of its children, closed with the last of them
+    struct Handle {
+        int fd;
+
+        explicit Handle(int f) : fd(f) {}
+
+        ~Handle() { close(fd); }
+    };
+
+    struct Task {
+        std::shared_ptr<Handle> parent;
+        // relative to the root
+        std::string path;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::size_t _thread_count;
+    std::size_t _buffer_size;
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+    // tasks queued or running, the walk ends when it drops to 0
+    std::atomic<std::size_t> _pending{0};
+    std::mutex _idle_mutex;
+    std::condition_variable _idle_cond;
+    std::size_t _idle{0};
+    std::atomic<bool> _abort{false};
+    std::exception_ptr _error;
+    std::mutex _error_mutex;
+
+    void push(std::size_t self, Task &&task) {
+        _pending.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(_workers[self]->mutex);
+            _workers[self]->tasks.push_back(std::move(task));
+        }
+        std::lock_guard<std::mutex> lock(_idle_mutex);
+        if (_idle > 0)
+            _idle_cond.notify_one();
+    }
+
+    // own tasks newest first, then the oldest task of the others
+    bool pop(std::size_t self, Task &task) {
+        {
+            auto &own = *_workers[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (std::size_t i = 1; i < _workers.size(); i++) {
+            auto &victim = *_workers[(self + i) % _workers.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void fail(std::exception_ptr error) {
+        {
+            std::lock_guard<std::mutex> lock(_error_mutex);
+            if (_error == nullptr)
+                _error = error;
+        }
+        _abort.store(true, std::memory_order_relaxed);
+    }
+
+    void finish() {
+        if (_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(_idle_mutex);
+            _idle_cond.notify_all();
+        }
+    }
+
+    void readDirectory(std::size_t self, int fd, std::string const &path,
+                       std::vector<char> &buffer, Visitor const &visitor) {
+        auto handle = std::make_shared<Handle>(fd);
+        while (!_abort.load(std::memory_order_relaxed)) {
+            auto n = getdents64(fd, buffer.data(), buffer.size());
+            if (n == -1)
+                throw std::runtime_error(path + ": " + strerror(errno));
+            if (n == 0)
+                break;
+            for (ssize_t pos = 0; pos < n;) {
+                auto d = reinterpret_cast<struct dirent64 *>(buffer.data() + pos);
+                pos += d->d_reclen;
+                char const *name = d->d_name;
+                if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                    continue;
+
+                unsigned char type = d->d_type;
+                if (type == DT_UNKNOWN) {
+                    struct stat st{};
+                    if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+                        continue;
+                    type = IFTODT(st.st_mode);
+                }
+                Entry entry{path, name, type, d->d_ino, fd};
+                if (!visitor(entry) || type != DT_DIR)
+                    continue;
+                std::string child;
+                child.reserve(path.size() + 1 + entry.name.size());
+                if (!path.empty()) {
+                    child += path;
+                    child += '/';
+                }
+                child += entry.name;
+                push(self, Task{handle, std::move(child)});
+            }
+        }
+    }
+
+    void run(std::size_t self, Visitor const &visitor) {
+        std::vector<char> buffer(_buffer_size);
+        Task task;
+        while (true) {
+            if (pop(self, task)) {
+                if (!_abort.load(std::memory_order_relaxed)) {
+                    try {
+                        auto slash = task.path.rfind('/');
+                        auto name = slash == std::string::npos ? task.path : task.path.substr(slash + 1);
+                        int fd = openat(task.parent->fd, name.c_str(),
+                                        O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                        // release the parent before descending
+                        task.parent.reset();
+                        // removed or replaced since it was listed
+                        if (fd == -1 && errno != ENOENT && errno != ENOTDIR)
+                            throw std::runtime_error(task.path + ": " + strerror(errno));
+                        if (fd != -1)
+                            readDirectory(self, fd, task.path, buffer, visitor);
+                    } catch (...) {
+                        fail(std::current_exception());
+                    }
+                }
+                task = Task{};
+                finish();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(_idle_mutex);
+            if (_pending.load(std::memory_order_acquire) == 0)
+                return;
+            _idle++;
+            // a push between the failed pop and here only notifies, so don't sleep long
+            _idle_cond.wait_for(lock, std::chrono::milliseconds(1));
+            _idle--;
+        }
+    }
+
+public:
+    // threads: 0 means one per CPU
+    // bufferSize: getdents64() buffer per thread
+    explicit DirWalker(std::size_t threads = 0, std::size_t bufferSize = 1 << 20)
+            : _thread_count(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency())),
+              _buffer_size(std::max<std::size_t>(bufferSize, 4096)) {}
+
+    DirWalker(DirWalker const &) = delete;
+
+    void operator=(DirWalker const &) = delete;
+
+    // visit every entry below root (the root itself is not visited)
+    // rethrows the first exception of the visitor or of the walk, the walk stops early then
+    void Walk(std::string const &root, Visitor const &visitor) {
+        int fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1)
+            throw std::runtime_error(root + ": " + strerror(errno));
+
+        _workers.clear();
+        for (std::size_t i = 0; i < _thread_count; i++)
+            _workers.push_back(std::make_unique<Worker>());
+        _abort = false;
+        _error = nullptr;
+        _pending = 1;
+
+        // the calling thread is worker 0 and lists the root
+        std::vector<std::thread> threads;
+        for (std::size_t i = 1; i < _thread_count; i++)
+            threads.emplace_back([this, i, &visitor] { run(i, visitor); });
+        {
+            std::vector<char> buffer(_buffer_size);
+            try {
+                readDirectory(0, fd, "", buffer, visitor);
+            } catch (...) {
+                fail(std::current_exception());
+            }
+        }
+        finish();
+        run(0, visitor);
+        for (auto &t : threads)
+            t.join();
+
+        _workers.clear();
+        if (_error != nullptr)
+            std::rethrow_exception(_error);
+    }
+};
+
+#endif //DIR_WALKER_H
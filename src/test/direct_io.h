@@ -0,0 +1,429 @@
+#ifndef DIRECT_IO_H
+#define DIRECT_IO_H
+
+// O_DIRECT file I/O that bypasses the page cache
+//
+// O_DIRECT needs the buffer address, the file offset and the length to be
+// multiples of the device's logical block size; DirectFile hides that:
+// requests are split into chunks read/written through buffers of an
+// AlignedBufferPool, unaligned heads and tails are padded (read-modify-write
+// for writes), and up to queueDepth chunks are in flight at once through
+// Linux native AIO (io_submit), falling back to pread/pwrite when the
+// kernel refuses an AIO context
+//
+// a chunk holds its buffer only while it is in flight, so one pool shared
+// by several files bounds the aligned memory they use together
+
+#include "fs_wrap.h"
+
+#include <linux/aio_abi.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <condition_variable>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// fixed set of equally sized buffers, each aligned to alignment
+// thread safe, may be shared by DirectFiles on different threads
+class AlignedBufferPool {
+private:
+    std::size_t _alignment;
+    std::size_t _buffer_size;
+    char *_slab{nullptr};
+    std::vector<char *> _free;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+
+public:
+    // bufferSize is rounded up to a multiple of alignment
+    AlignedBufferPool(std::size_t alignment, std::size_t bufferSize, std::size_t count)
+            : _alignment(alignment),
+              _buffer_size((std::max(bufferSize, alignment) + alignment - 1) / alignment * alignment) {
+        void *p = nullptr;
+        int err = posix_memalign(&p, alignment, _buffer_size * count);
+        if (err != 0)
+            throw std::runtime_error(strerror(err));
+        _slab = static_cast<char *>(p);
+        for (std::size_t i = 0; i < count; i++)
+            _free.push_back(_slab + i * _buffer_size);
+    }
+
+    ~AlignedBufferPool() {
+        free(_slab);
+    }
+
+    AlignedBufferPool(AlignedBufferPool const &) = delete;
+
+    void operator=(AlignedBufferPool const &) = delete;
+
+    std::size_t Alignment() const { return _alignment; }
+
+    std::size_t BufferSize() const { return _buffer_size; }
+
+    // wait until a buffer is free
+    char *Acquire() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cond.wait(lock, [this] { return !_free.empty(); });
+        auto res = _free.back();
+        _free.pop_back();
+        return res;
+    }
+
+    // nullptr if every buffer is in use
+    char *TryAcquire() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_free.empty())
+            return nullptr;
+        auto res = _free.back();
+        _free.pop_back();
+        return res;
+    }
+
+    void Release(char *buffer) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _free.push_back(buffer);
+        }
+        _cond.notify_one();
+    }
+};
+
+// not thread safe, use one DirectFile per thread
+class DirectFile {
+private:
+    // one chunk of a request, buffer is taken from the pool while it is in flight
+    struct Slot {
+        struct iocb cb{};
+        char *buffer{nullptr};
+        off_t offset{0};
+        std::size_t length{0};
+        ssize_t result{0};
+        bool busy{false};
+        bool done{false};
+    };
+
+    FD _fd;
+    std::size_t _alignment;
+    unsigned _depth;
+    std::shared_ptr<AlignedBufferPool> _pool;
+    aio_context_t _ctx{0};
+    std::vector<Slot> _slots;
+    unsigned _inflight{0};
+
+    static std::size_t logicalBlockSize(FD const &fd) {
+        struct stat st{};
+        if (fstat(fd.Get(), &st) == 0 && S_ISBLK(st.st_mode)) {
+            int size = 0;
+            if (ioctl(fd.Get(), BLKSSZGET, &size) == 0 && size > 0)
+                return size;
+        }
+#ifdef STATX_DIOALIGN
+        struct statx stx{};
+        if (statx(fd.Get(), "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 &&
+            (stx.stx_mask & STATX_DIOALIGN) != 0 && stx.stx_dio_offset_align != 0)
+            return std::max(stx.stx_dio_mem_align, stx.stx_dio_offset_align);
+#endif
+        // the largest logical block size in common use
+        return 4096;
+    }
+
+    std::size_t alignDown(std::size_t n) const { return n / _alignment * _alignment; }
+
+    std::size_t alignUp(std::size_t n) const { return (n + _alignment - 1) / _alignment * _alignment; }
+
+    // start slot's chunk, synchronously when there is no AIO context
+    void submit(Slot &slot, bool write) {
+        slot.busy = true;
+        slot.done = false;
+        if (_ctx == 0) {
+            ssize_t res;
+            do {
+                res = write ? pwrite(_fd.Get(), slot.buffer, slot.length, slot.offset)
+                            : pread(_fd.Get(), slot.buffer, slot.length, slot.offset);
+            } while (res == -1 && errno == EINTR);
+            slot.result = res == -1 ? -errno : res;
+            slot.done = true;
+            return;
+        }
+        slot.cb = {};
+        slot.cb.aio_data = reinterpret_cast<uintptr_t>(&slot);
+        slot.cb.aio_lio_opcode = write ? IOCB_CMD_PWRITE : IOCB_CMD_PREAD;
+        slot.cb.aio_fildes = _fd.Get();
+        slot.cb.aio_buf = reinterpret_cast<uintptr_t>(slot.buffer);
+        slot.cb.aio_nbytes = slot.length;
+        slot.cb.aio_offset = slot.offset;
+        struct iocb *list[1] = {&slot.cb};
+        long res;
+        do {
+            res = syscall(SYS_io_submit, _ctx, 1, list);
+        } while (res == -1 && errno == EINTR);
+        if (res != 1) {
+            slot.busy = false;
+            throw std::runtime_error(strerror(errno));
+        }
+        _inflight++;
+    }
+
+    // reap completions until slot is done
+    void wait(Slot &slot) {
+        struct io_event events[64];
+        while (!slot.done) {
+            long n = syscall(SYS_io_getevents, _ctx, 1, 64, events, nullptr);
+            if (n == -1) {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error(strerror(errno));
+            }
+            for (long i = 0; i < n; i++) {
+                auto done = reinterpret_cast<Slot *>(static_cast<uintptr_t>(events[i].data));
+                done->result = events[i].res;
+                done->done = true;
+                _inflight--;
+            }
+        }
+    }
+
+    // a buffer for the next chunk; waits on the pool only when none of ours is
+    // in flight, otherwise nullptr and the caller reaps one of them first
+    bool takeBuffer(Slot &slot, bool idle) {
+        slot.buffer = idle ? _pool->Acquire() : _pool->TryAcquire();
+        return slot.buffer != nullptr;
+    }
+
+    void releaseBuffer(Slot &slot) {
+        if (slot.buffer != nullptr)
+            _pool->Release(slot.buffer);
+        slot.buffer = nullptr;
+    }
+
+    // no buffer may go back to the pool while the kernel still owns it,
+    // one whose completion can't be reaped is left out of the pool
+    void drain() {
+        for (auto &slot : _slots) {
+            if (slot.busy) {
+                try {
+                    wait(slot);
+                } catch (std::exception const &) {
+                }
+                slot.busy = false;
+                if (!slot.done)
+                    slot.buffer = nullptr;
+            }
+            releaseBuffer(slot);
+        }
+    }
+
+    static void check(Slot const &slot) {
+        if (slot.result < 0)
+            throw std::runtime_error(strerror(-slot.result));
+    }
+
+    // a write can complete short (ENOSPC part-way); the rest is written
+    // synchronously so the real error surfaces, which O_DIRECT only allows
+    // from a block boundary
+    void checkWrite(Slot const &slot) {
+        check(slot);
+        auto done = static_cast<std::size_t>(slot.result);
+        while (done < slot.length) {
+            if (done % _alignment != 0)
+                throw std::runtime_error("short O_DIRECT write");
+            auto res = pwrite(_fd.Get(), slot.buffer + done, slot.length - done, slot.offset + done);
+            if (res == -1) {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error(strerror(errno));
+            }
+            if (res == 0)
+                throw std::runtime_error(strerror(ENOSPC));
+            done += res;
+        }
+    }
+
+public:
+    // writable opens O_RDWR | O_CREAT (unaligned writes need to read the blocks they patch)
+    // queueDepth: chunks in flight, chunkSize: bytes per chunk, from a pool of its own
+    explicit DirectFile(std::string const &path, bool writable = false, unsigned queueDepth = 8,
+                        std::size_t chunkSize = 1 << 20, mode_t mode = 0644)
+            : _fd(FS::Open(path, (writable ? O_RDWR | O_CREAT : O_RDONLY) | O_DIRECT | O_CLOEXEC, mode)),
+              _alignment(logicalBlockSize(_fd)),
+              _depth(std::max(queueDepth, 1u)),
+              _pool(std::make_shared<AlignedBufferPool>(_alignment, chunkSize, _depth)),
+              _slots(_depth) {
+        if (syscall(SYS_io_setup, _depth, &_ctx) == -1)
+            _ctx = 0;
+    }
+
+    // chunks are the shared pool's buffers, its alignment must be a multiple of the file's
+    DirectFile(std::string const &path, std::shared_ptr<AlignedBufferPool> pool, bool writable = false,
+               unsigned queueDepth = 8, mode_t mode = 0644)
+            : _fd(FS::Open(path, (writable ? O_RDWR | O_CREAT : O_RDONLY) | O_DIRECT | O_CLOEXEC, mode)),
+              _alignment(logicalBlockSize(_fd)),
+              _depth(std::max(queueDepth, 1u)),
+              _pool(std::move(pool)),
+              _slots(_depth) {
+        if (_pool == nullptr || _pool->Alignment() % _alignment != 0)
+            throw std::runtime_error(strerror(EINVAL));
+        if (syscall(SYS_io_setup, _depth, &_ctx) == -1)
+            _ctx = 0;
+    }
+
+    ~DirectFile() {
+        drain();
+        if (_ctx != 0)
+            syscall(SYS_io_destroy, _ctx);
+    }
+
+    DirectFile(DirectFile const &) = delete;
+
+    void operator=(DirectFile const &) = delete;
+
+    std::size_t Alignment() const { return _alignment; }
+
+    // false when running on the pread/pwrite fallback
+    bool Async() const { return _ctx != 0; }
+
+    // st_size is 0 for a block device, it is asked for its capacity instead
+    std::size_t Size() const {
+        FS::FileState state;
+        state(_fd);
+        if (S_ISBLK(state.FileMode())) {
+            uint64_t bytes = 0;
+            if (ioctl(_fd.Get(), BLKGETSIZE64, &bytes) == -1)
+                throw std::runtime_error(strerror(errno));
+            return bytes;
+        }
+        return state.FileSize();
+    }
+
+    // stream [offset, offset + length) to f(off_t offset, std::string_view data) in file order,
+    // chunk by chunk, with up to queueDepth chunks read ahead; stops at end of file
+    template<class F>
+    void Scan(off_t offset, std::size_t length, F &&f) {
+        std::size_t end = std::min(static_cast<std::size_t>(offset) + length, Size());
+        if (static_cast<std::size_t>(offset) >= end)
+            return;
+        std::size_t chunk = _pool->BufferSize();
+        std::size_t next = alignDown(offset);
+        uint64_t submitted = 0, delivered = 0;
+        try {
+            while (true) {
+                while (next < end && submitted - delivered < _depth) {
+                    auto &slot = _slots[submitted % _depth];
+                    if (!takeBuffer(slot, submitted == delivered))
+                        break;
+                    slot.offset = next;
+                    slot.length = std::min(chunk, alignUp(end) - next);
+                    submit(slot, false);
+                    next += slot.length;
+                    submitted++;
+                }
+                if (delivered == submitted)
+                    break;
+                auto &slot = _slots[delivered % _depth];
+                wait(slot);
+                slot.busy = false;
+                check(slot);
+                delivered++;
+                // trim the alignment padding on both sides
+                std::size_t from = std::max<std::size_t>(slot.offset, offset);
+                std::size_t to = std::min<std::size_t>(slot.offset + slot.result, end);
+                if (to > from)
+                    f(static_cast<off_t>(from), std::string_view(slot.buffer + (from - slot.offset), to - from));
+                releaseBuffer(slot);
+                // short read, the file shrank under us
+                if (static_cast<std::size_t>(slot.result) < slot.length)
+                    next = end;
+            }
+        } catch (...) {
+            drain();
+            throw;
+        }
+    }
+
+    // returns bytes read, short only at end of file
+    std::size_t Read(off_t offset, char *out, std::size_t length) {
+        std::size_t total = 0;
+        Scan(offset, length, [&](off_t at, std::string_view data) {
+            std::memcpy(out + (at - offset), data.data(), data.size());
+            total += data.size();
+        });
+        return total;
+    }
+
+    // unaligned head and tail blocks are read, patched and written back whole
+    // writing past the end grows the file to exactly offset + length
+    void Write(off_t offset, char const *data, std::size_t length) {
+        if (length == 0)
+            return;
+        std::size_t size = Size();
+        std::size_t begin = offset, end = begin + length;
+        std::size_t chunk = _pool->BufferSize();
+        std::size_t next = alignDown(begin);
+        std::size_t stop = alignUp(end);
+
+        // fill one aligned block of buf (at file offset at) with what is on disk
+        auto preload = [this, size](char *buf, std::size_t at) {
+            std::memset(buf, 0, _alignment);
+            if (at >= size)
+                return;
+            ssize_t res;
+            do {
+                res = pread(_fd.Get(), buf, _alignment, at);
+            } while (res == -1 && errno == EINTR);
+            if (res == -1)
+                throw std::runtime_error(strerror(errno));
+        };
+
+        uint64_t submitted = 0, completed = 0;
+        try {
+            while (next < stop || completed < submitted) {
+                if (next < stop && submitted - completed < _depth &&
+                    takeBuffer(_slots[submitted % _depth], submitted == completed)) {
+                    auto &slot = _slots[submitted % _depth];
+                    slot.offset = next;
+                    slot.length = std::min(chunk, stop - next);
+                    std::size_t from = std::max(begin, next), to = std::min(end, next + slot.length);
+                    if (from % _alignment != 0)
+                        preload(slot.buffer, alignDown(from));
+                    if (to % _alignment != 0 && (alignDown(to) != alignDown(from) || from % _alignment == 0))
+                        preload(slot.buffer + (alignDown(to) - next), alignDown(to));
+                    std::memcpy(slot.buffer + (from - next), data + (from - begin), to - from);
+                    submit(slot, true);
+                    next += slot.length;
+                    submitted++;
+                    continue;
+                }
+                auto &slot = _slots[completed % _depth];
+                wait(slot);
+                slot.busy = false;
+                checkWrite(slot);
+                releaseBuffer(slot);
+                completed++;
+            }
+        } catch (...) {
+            drain();
+            throw;
+        }
+
+        // the padded tail block may have grown the file past the data
+        if (stop > size && stop > end) {
+            if (ftruncate(_fd.Get(), std::max(size, end)) == -1)
+                throw std::runtime_error(strerror(errno));
+        }
+    }
+
+    // durable against power loss, O_DIRECT alone leaves the device cache and metadata
+    void Sync() {
+        if (fdatasync(_fd.Get()) == -1)
+            throw std::runtime_error(strerror(errno));
+    }
+};
+
+#endif //DIRECT_IO_H
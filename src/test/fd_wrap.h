@@ -89,11 +89,15 @@ public:
     FD(FD const &) = delete;
     void operator=(FD const &) = delete;
     FD &operator=(FD &&obj) noexcept {
+        if (this == &obj)
+            return *this;
         if (_fd >= 0) {
             close(_fd);
         }
         _fd = obj._fd;
-        _valid = true;
+        _valid = obj._valid;
+        obj._fd = -1;
+        obj._valid = false;
         return *this;
     }
     ~FD() {
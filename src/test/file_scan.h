@@ -0,0 +1,160 @@
+#ifndef FILE_SCAN_H
+#define FILE_SCAN_H
+
+// streaming scan of a file, front to back
+//
+// the file is read in windows through two buffers: a background thread
+// reads window k + 1 while the caller works on window k, so disk and CPU
+// overlap; the kernel is told the access pattern up front
+// (POSIX_FADV_SEQUENTIAL), asked to start on the window after the one
+// being read (POSIX_FADV_WILLNEED), and with dropBehind the pages of
+// consumed windows are released (POSIX_FADV_DONTNEED), so a scan of a huge
+// file doesn't push everybody else's data out of the page cache
+
+#include "fs_wrap.h"
+
+#include <fcntl.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+
+class SequentialScan {
+private:
+    struct Window {
+        std::unique_ptr<char[]> data;
+        off_t offset{0};
+        // -1 empty, otherwise bytes read (0 at end of range)
+        ssize_t size{-1};
+        // errno of a failed read, the range ends with this window
+        int error{0};
+    };
+
+    FD &_fd;
+    std::size_t _window_size;
+    bool _drop_behind;
+    off_t _begin;
+    off_t _end;
+
+    Window _windows[2];
+    // the window the caller holds, -1 before the first Next()
+    int _current{-1};
+    std::size_t _taken{0};
+    bool _stop{false};
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::thread _reader;
+
+    void advise(off_t offset, off_t length, int advice) {
+        if (length > 0)
+            posix_fadvise(_fd.Get(), offset, length, advice);
+    }
+
+    void readAhead() {
+        off_t pos = _begin;
+        for (std::size_t k = 0;; k++) {
+            auto &window = _windows[k % 2];
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cond.wait(lock, [&] { return window.size == -1 || _stop; });
+                if (_stop)
+                    return;
+            }
+            std::size_t want = std::min<off_t>(_window_size, _end - pos);
+            // the kernel fetches the window after this one meanwhile
+            advise(pos + want, std::min<off_t>(_window_size, _end - pos - want), POSIX_FADV_WILLNEED);
+            std::size_t n = 0;
+            int error = 0;
+            while (n < want) {
+                auto res = pread(_fd.Get(), window.data.get() + n, want - n, pos + n);
+                if (res == -1) {
+                    if (errno == EINTR)
+                        continue;
+                    error = errno;
+                    break;
+                }
+                if (res == 0)
+                    break;
+                n += res;
+            }
+            std::lock_guard<std::mutex> lock(_mutex);
+            window.offset = pos;
+            window.size = n;
+            window.error = error;
+            _cond.notify_all();
+            if (n == 0 || error != 0)
+                return;
+            pos += n;
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cond.notify_all();
+        if (_reader.joinable())
+            _reader.join();
+    }
+
+public:
+    // fd must outlive the scan and is only read with pread(), its offset is untouched
+    // length 0 scans from offset to the end of the file
+    explicit SequentialScan(FD &fd, std::size_t windowSize = 4 << 20, bool dropBehind = true,
+                            off_t offset = 0, std::size_t length = 0)
+            : _fd(fd), _window_size(std::max<std::size_t>(windowSize, 4096)), _drop_behind(dropBehind),
+              _begin(offset) {
+        FS::FileState state;
+        state(fd);
+        off_t size = state.FileSize();
+        _end = length == 0 ? size : std::min<off_t>(size, offset + length);
+        if (_end < _begin)
+            _end = _begin;
+        for (auto &window : _windows)
+            window.data.reset(new char[_window_size]);
+        advise(_begin, _end - _begin, POSIX_FADV_SEQUENTIAL);
+        _reader = std::thread([this] { readAhead(); });
+    }
+
+    ~SequentialScan() {
+        stop();
+    }
+
+    SequentialScan(SequentialScan const &) = delete;
+
+    void operator=(SequentialScan const &) = delete;
+
+    // the next window, the previous view is invalid afterwards
+    // false once the range is done; throw runtime_error if a read failed
+    bool Next(std::string_view &window) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (_current != -1) {
+            auto &done = _windows[_current];
+            if (done.size == 0 || done.error != 0)
+                return false;
+            if (_drop_behind)
+                advise(done.offset, done.size, POSIX_FADV_DONTNEED);
+            done.size = -1;
+            _cond.notify_all();
+        }
+        _current = _taken++ % 2;
+        auto &next = _windows[_current];
+        _cond.wait(lock, [&] { return next.size != -1; });
+        if (next.error != 0)
+            throw std::runtime_error(strerror(next.error));
+        if (next.size == 0)
+            return false;
+        window = std::string_view(next.data.get(), next.size);
+        return true;
+    }
+
+    // file offset of the window returned by the last Next()
+    off_t Offset() const {
+        return _current == -1 ? _begin : _windows[_current].offset;
+    }
+};
+
+#endif //FILE_SCAN_H
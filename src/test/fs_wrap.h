@@ -3,10 +3,22 @@
 
 #include "fd_wrap.h"
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
 #include <error.h>
 #include <dirent.h>
 
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
 
@@ -44,6 +56,16 @@ public:
         return tmp;
     }
 
+    // mode is only used along with O_CREAT or O_TMPFILE, see Create() for available value
+    static FD Open(std::string const &path, int flags, mode_t mode) {
+        int fd = open(path.c_str(), flags, mode);
+        if (fd == -1) {
+            throw std::runtime_error(strerror(errno));
+        }
+        FD tmp(fd);
+        return tmp;
+    }
+
     // Constant Octal value Permission bit
     // S_ISUID 04000 Set-user-ID
     // S_ISGID 02000 Set-group-ID
@@ -97,6 +119,136 @@ public:
         }
     }
 
+    // gather write, loop until every iovec is fully written
+    // iov is modified in place when the kernel takes a short write
+    static void WriteV(FD &fd, struct iovec *iov, int iovcnt) {
+        while (iovcnt > 0) {
+            auto res = writev(fd.Get(), iov, iovcnt);
+            if (res == -1) {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error(strerror(errno));
+            }
+            iovcnt = AdvanceIov(iov, iovcnt, res);
+        }
+    }
+
+    // read into a caller owned buffer, nothing is zero-filled first
+    static ssize_t Read(FD &fd, char *buf, std::size_t size) {
+        ssize_t sz = read(fd.Get(), buf, size);
+        if (sz == -1) {
+            throw std::runtime_error(strerror(errno));
+        }
+        return sz;
+    }
+
+    // positional I/O: the shared file offset is neither used nor moved,
+    // so several threads may read or write one fd concurrently
+
+    // loop until size bytes are read, short only at end of file
+    static std::size_t PRead(FD const &fd, char *buf, std::size_t size, off_t offset) {
+        std::size_t n = 0;
+        while (n < size) {
+            auto res = pread(fd.Get(), buf + n, size - n, offset + n);
+            if (res == -1) {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error(strerror(errno));
+            }
+            if (res == 0)
+                break;
+            n += res;
+        }
+        return n;
+    }
+
+    static void PWrite(FD const &fd, char const *buf, std::size_t size, off_t offset) {
+        std::size_t n = 0;
+        while (n < size) {
+            auto res = pwrite(fd.Get(), buf + n, size - n, offset + n);
+            if (res == -1) {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error(strerror(errno));
+            }
+            n += res;
+        }
+    }
+
+    // skip the first n bytes of iov, returns the new iovcnt
+    static int AdvanceIov(struct iovec *&iov, int iovcnt, std::size_t n) {
+        while (iovcnt > 0 && n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+        return iovcnt;
+    }
+
+    // scatter read, loop until every iovec is filled, short only at end of file
+    // iov is modified in place like WriteV
+    static std::size_t PReadV(FD const &fd, struct iovec *iov, int iovcnt, off_t offset) {
+        std::size_t total = 0;
+        while (iovcnt > 0) {
+            auto res = preadv(fd.Get(), iov, iovcnt, offset + total);
+            if (res == -1) {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error(strerror(errno));
+            }
+            if (res == 0)
+                break;
+            total += res;
+            iovcnt = AdvanceIov(iov, iovcnt, res);
+        }
+        return total;
+    }
+
+    // gather write, loop until every iovec is fully written
+    static void PWriteV(FD const &fd, struct iovec *iov, int iovcnt, off_t offset) {
+        std::size_t total = 0;
+        while (iovcnt > 0) {
+            auto res = pwritev(fd.Get(), iov, iovcnt, offset + total);
+            if (res == -1) {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error(strerror(errno));
+            }
+            total += res;
+            iovcnt = AdvanceIov(iov, iovcnt, res);
+        }
+    }
+
+    // page cache only read for an event loop: preadv2(RWF_NOWAIT) never waits for the disk
+    // returns the bytes served from the page cache (possibly short, 0 at end of file),
+    // or -1 when the first byte isn't cached and the read has to be offloaded to a thread
+    // -1 is also returned by file systems without RWF_NOWAIT support
+    static ssize_t TryPReadV(FD const &fd, struct iovec const *iov, int iovcnt, off_t offset) {
+#ifdef RWF_NOWAIT
+        while (true) {
+            auto res = preadv2(fd.Get(), iov, iovcnt, offset, RWF_NOWAIT);
+            if (res != -1)
+                return res;
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EOPNOTSUPP)
+                return -1;
+            throw std::runtime_error(strerror(errno));
+        }
+#else
+        return -1;
+#endif
+    }
+
+    static ssize_t TryPRead(FD const &fd, char *buf, std::size_t size, off_t offset) {
+        struct iovec iov{buf, size};
+        return TryPReadV(fd, &iov, 1, offset);
+    }
+
     static void Close(FD &fd) {
         int res = close(fd.Get());
         if (res == -1)
@@ -261,6 +413,146 @@ public:
     };
 
 
+    // memory mapped view of a file or a range of it, unmapped on destruction
+    // read-only mappings are MAP_PRIVATE, so every process mapping the same
+    // file shares its page cache instead of holding a heap copy
+    // writable mappings are MAP_SHARED, stores reach the file (Sync() to make them durable)
+    class MappedFile {
+    private:
+        // page aligned mapping
+        char *_map{nullptr};
+        std::size_t _map_size{0};
+        // the requested range inside it
+        char *_data{nullptr};
+        std::size_t _size{0};
+        bool _writable{false};
+
+        void unmap() {
+            if (_map != nullptr)
+                munmap(_map, _map_size);
+            _map = _data = nullptr;
+            _map_size = _size = 0;
+        }
+
+    public:
+        MappedFile() = default;
+
+        // length 0 maps from offset to the end of the file, offset needn't be page aligned
+        // populate prefaults the whole range (MAP_POPULATE), so the first access doesn't page fault
+        explicit MappedFile(FD const &fd, bool writable = false, std::size_t offset = 0,
+                            std::size_t length = 0, bool populate = false)
+                : _writable(writable) {
+            FileState state;
+            state(fd);
+            auto file_size = static_cast<std::size_t>(state.FileSize());
+            if (offset > file_size)
+                throw std::runtime_error("mapping offset beyond the end of file");
+            if (length == 0 || length > file_size - offset)
+                length = file_size - offset;
+            // mmap() rejects an empty mapping, leave it unmapped
+            if (length == 0)
+                return;
+
+            auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+            std::size_t start = offset / page * page;
+            _map_size = offset - start + length;
+            int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+            int flags = (writable ? MAP_SHARED : MAP_PRIVATE) | (populate ? MAP_POPULATE : 0);
+            void *p = mmap(nullptr, _map_size, prot, flags, fd.Get(), start);
+            if (p == MAP_FAILED)
+                throw std::runtime_error(strerror(errno));
+            _map = static_cast<char *>(p);
+            _data = _map + (offset - start);
+            _size = length;
+        }
+
+        static MappedFile Open(std::string const &path, bool writable = false, bool populate = false) {
+            auto fd = FS::Open(path, (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+            return MappedFile(fd, writable, 0, 0, populate);
+        }
+
+        MappedFile(MappedFile const &) = delete;
+
+        void operator=(MappedFile const &) = delete;
+
+        MappedFile(MappedFile &&obj) noexcept
+                : _map(obj._map), _map_size(obj._map_size), _data(obj._data),
+                  _size(obj._size), _writable(obj._writable) {
+            obj._map = obj._data = nullptr;
+            obj._map_size = obj._size = 0;
+        }
+
+        MappedFile &operator=(MappedFile &&obj) noexcept {
+            if (this != &obj) {
+                unmap();
+                _map = obj._map;
+                _map_size = obj._map_size;
+                _data = obj._data;
+                _size = obj._size;
+                _writable = obj._writable;
+                obj._map = obj._data = nullptr;
+                obj._map_size = obj._size = 0;
+            }
+            return *this;
+        }
+
+        ~MappedFile() {
+            unmap();
+        }
+
+        char const *Data() const { return _data; }
+
+        // only for writable mappings
+        char *MutableData() {
+            if (!_writable)
+                throw std::runtime_error("File is mapped read-only");
+            return _data;
+        }
+
+        std::size_t Size() const { return _size; }
+
+        bool Empty() const { return _size == 0; }
+
+        std::string_view View() const { return std::string_view(_data, _size); }
+
+        // clamped to the mapped range
+        std::string_view View(std::size_t offset, std::size_t length) const {
+            if (offset >= _size)
+                return {};
+            return std::string_view(_data + offset, std::min(length, _size - offset));
+        }
+
+        // Advice Range
+        // MADV_NORMAL no special treatment
+        // MADV_SEQUENTIAL read ahead aggressively, drop pages soon after they are read
+        // MADV_RANDOM don't read ahead
+        // MADV_WILLNEED start reading the range in now
+        // MADV_DONTNEED the range won't be needed soon, drop it from this mapping
+        // MADV_HUGEPAGE back the range with transparent huge pages where the file system allows it
+        // offset and length are relative to Data(), length 0 means up to the end
+        void Advise(int advice, std::size_t offset = 0, std::size_t length = 0) {
+            if (_map == nullptr || offset >= _size)
+                return;
+            if (length == 0 || length > _size - offset)
+                length = _size - offset;
+            // madvise() wants a page aligned start
+            char *begin = _data + offset;
+            char *aligned = _map + (begin - _map) / sysconf(_SC_PAGESIZE) * sysconf(_SC_PAGESIZE);
+            if (madvise(aligned, begin + length - aligned, advice) == -1)
+                throw std::runtime_error(strerror(errno));
+        }
+
+        // write dirty pages of a writable mapping back to the file
+        // async only schedules the writeback (MS_ASYNC)
+        void Sync(bool async = false) {
+            if (_map == nullptr || !_writable)
+                return;
+            if (msync(_map, _map_size, async ? MS_ASYNC : MS_SYNC) == -1)
+                throw std::runtime_error(strerror(errno));
+        }
+    };
+
+
     // -1 for no change
     static void Chown(std::string const &path, uid_t owner = -1, gid_t group = -1) {
         if (chown(path.c_str(), owner, group) == -1)
@@ -312,7 +604,7 @@ public:
                 : inode{i}, name{std::move(n)} {}
     };
 
-    // not finish
+    // one level only, see DirWalker (dir_walker.h) for a recursive walk
     static std::vector<Directory> ReadDirectory(std::string const &path) {
         auto dir = opendir(path.c_str());
         if (dir == nullptr)
@@ -324,8 +616,10 @@ public:
         while ((entry = readdir(dir)) != nullptr) {
             res.emplace_back(entry->d_ino, entry->d_name);
         }
-        if (errno != 0) {
-            throw std::runtime_error(strerror(errno));
+        int err = errno;
+        closedir(dir);
+        if (err != 0) {
+            throw std::runtime_error(strerror(err));
         }
         return res;
     }
@@ -352,6 +646,229 @@ public:
         if (rename(oldname.c_str(), newname.c_str()) == -1)
             throw std::runtime_error(strerror(errno));
     }
+
+    // how Copy() moved the data, the first method in this order that works is used
+    enum class CopyMethod {
+        CLONE,              // FICLONE reflink, no data copied at all
+        COPY_FILE_RANGE,    // copied inside the kernel (or offloaded to the storage)
+        SENDFILE,           // through the page cache, no user space copy
+        READ_WRITE          // pread/pwrite through two buffers, reading overlaps writing
+    };
+
+    struct CopyOptions {
+        bool reflink{true};
+        // keep holes: only the ranges SEEK_DATA reports are copied
+        bool sparse{true};
+        // false fails with EEXIST if dst exists
+        bool overwrite{true};
+        // chunk per system call, and buffer size of the READ_WRITE pipeline
+        std::size_t chunkSize{1 << 20};
+        // (bytes done, file size) after every chunk, holes count as done
+        std::function<void(std::size_t, std::size_t)> progress{};
+    };
+
+    static CopyMethod Copy(std::string const &src, std::string const &dst) {
+        return Copy(src, dst, CopyOptions{});
+    }
+
+    // dst gets src's data and permission bits
+    static CopyMethod Copy(std::string const &src, std::string const &dst, CopyOptions const &options) {
+        auto in = Open(src, O_RDONLY | O_CLOEXEC);
+        FileState state;
+        state(in);
+        auto size = static_cast<std::size_t>(state.FileSize());
+        // no O_TRUNC: dst may be src under another name, cp refuses that too
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (options.overwrite ? 0 : O_EXCL);
+        auto out = Open(dst, flags, state.FileMode() & 07777);
+        FileState dst_state;
+        dst_state(out);
+        if (dst_state.Get().st_dev == state.Get().st_dev && dst_state.Get().st_ino == state.Get().st_ino)
+            throw std::runtime_error(strerror(EINVAL));
+        // the open mode only applies when dst is created
+        Chmod(out, state.FileMode() & 07777);
+        if (ftruncate(out.Get(), 0) == -1)
+            throw std::runtime_error(strerror(errno));
+        std::size_t chunk = std::max<std::size_t>(options.chunkSize, 4096);
+        auto report = [&](std::size_t done) {
+            if (options.progress)
+                options.progress(done, size);
+        };
+
+        if (options.reflink && ioctl(out.Get(), FICLONE, in.Get()) == 0) {
+            report(size);
+            return CopyMethod::CLONE;
+        }
+
+        auto method = CopyMethod::COPY_FILE_RANGE;
+        off_t pos = 0;
+        while (static_cast<std::size_t>(pos) < size) {
+            // next data extent [begin, end)
+            off_t begin = pos, end = size;
+            if (options.sparse) {
+                begin = lseek(in.Get(), pos, SEEK_DATA);
+                if (begin == -1 && errno == ENXIO)
+                    break;  // only a hole left
+                if (begin == -1) {
+                    // no SEEK_DATA support, treat the rest as data
+                    begin = pos;
+                } else {
+                    end = lseek(in.Get(), begin, SEEK_HOLE);
+                    if (end == -1)
+                        end = size;
+                }
+                report(begin);
+            }
+            method = copyRange(in.Get(), out.Get(), begin, end, method, chunk, report);
+            pos = end;
+        }
+
+        // a trailing hole, and files that shrank meanwhile
+        if (ftruncate(out.Get(), size) == -1)
+            throw std::runtime_error(strerror(errno));
+        report(size);
+        return method;
+    }
+
+private:
+    // copy [begin, end) to the same offsets, degrading method when the kernel refuses it
+    template<class Report>
+    static CopyMethod copyRange(int in, int out, off_t begin, off_t end, CopyMethod method,
+                                std::size_t chunk, Report &report) {
+        off_t pos = begin;
+        if (method == CopyMethod::COPY_FILE_RANGE) {
+            while (pos < end) {
+                loff_t from = pos, to = pos;
+                auto n = copy_file_range(in, &from, out, &to, std::min<std::size_t>(chunk, end - pos), 0);
+                if (n == -1) {
+                    if (errno == EINTR)
+                        continue;
+                    // cross file system before 5.3, unsupported file systems
+                    if (pos == begin && (errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+                                         errno == EOPNOTSUPP)) {
+                        method = CopyMethod::SENDFILE;
+                        break;
+                    }
+                    throw std::runtime_error(strerror(errno));
+                }
+                if (n == 0)
+                    return method;  // src shrank
+                pos += n;
+                report(pos);
+            }
+            if (method == CopyMethod::COPY_FILE_RANGE)
+                return method;
+        }
+
+        if (method == CopyMethod::SENDFILE) {
+            // sendfile() writes at the file offset of out
+            if (lseek(out, pos, SEEK_SET) == -1)
+                throw std::runtime_error(strerror(errno));
+            while (pos < end) {
+                off_t from = pos;
+                auto n = sendfile(out, in, &from, std::min<std::size_t>(chunk, end - pos));
+                if (n == -1) {
+                    if (errno == EINTR)
+                        continue;
+                    if (pos == begin && (errno == EINVAL || errno == ENOSYS)) {
+                        method = CopyMethod::READ_WRITE;
+                        break;
+                    }
+                    throw std::runtime_error(strerror(errno));
+                }
+                if (n == 0)
+                    return method;
+                pos += n;
+                report(pos);
+            }
+            if (method == CopyMethod::SENDFILE)
+                return method;
+        }
+
+        copyBuffered(in, out, pos, end, chunk, report);
+        return CopyMethod::READ_WRITE;
+    }
+
+    // a helper thread reads chunk k + 1 while chunk k is written
+    template<class Report>
+    static void copyBuffered(int in, int out, off_t begin, off_t end, std::size_t chunk, Report &report) {
+        std::unique_ptr<char[]> buffers[2] = {std::unique_ptr<char[]>(new char[chunk]),
+                                              std::unique_ptr<char[]>(new char[chunk])};
+        // -1 empty, 0 no more data, > 0 bytes waiting to be written
+        ssize_t filled[2] = {-1, -1};
+        int read_error = 0;
+        bool abort = false;
+        std::mutex mutex;
+        std::condition_variable cond;
+
+        std::thread reader([&] {
+            off_t pos = begin;
+            for (std::size_t k = 0;; k++) {
+                auto slot = k % 2;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cond.wait(lock, [&] { return filled[slot] == -1 || abort; });
+                    if (abort)
+                        return;
+                }
+                ssize_t n = 0;
+                if (pos < end) {
+                    do {
+                        n = pread(in, buffers[slot].get(), std::min<std::size_t>(chunk, end - pos), pos);
+                    } while (n == -1 && errno == EINTR);
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                if (n == -1) {
+                    read_error = errno;
+                    n = 0;
+                }
+                filled[slot] = n;
+                cond.notify_all();
+                if (n == 0)
+                    return;
+                pos += n;
+            }
+        });
+
+        off_t pos = begin;
+        try {
+            for (std::size_t k = 0;; k++) {
+                auto slot = k % 2;
+                ssize_t n;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cond.wait(lock, [&] { return filled[slot] != -1; });
+                    n = filled[slot];
+                }
+                if (n == 0)
+                    break;
+                for (ssize_t done = 0; done < n;) {
+                    auto res = pwrite(out, buffers[slot].get() + done, n - done, pos + done);
+                    if (res == -1) {
+                        if (errno == EINTR)
+                            continue;
+                        throw std::runtime_error(strerror(errno));
+                    }
+                    done += res;
+                }
+                pos += n;
+                report(pos);
+                std::lock_guard<std::mutex> lock(mutex);
+                filled[slot] = -1;
+                cond.notify_all();
+            }
+        } catch (...) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                abort = true;
+                cond.notify_all();
+            }
+            reader.join();
+            throw;
+        }
+        reader.join();
+        if (read_error != 0)
+            throw std::runtime_error(strerror(read_error));
+    }
 };
 
 
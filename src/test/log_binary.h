@@ -0,0 +1,461 @@
+#ifndef LOG_BINARY_H
+#define LOG_BINARY_H
+
+// deferred formatting for the logger
+//
+// a call site owns a static LogSite (format string, file, line, ...),
+// the producer only copies a pointer to it plus the raw argument bytes,
+// formatting happens on the backend thread or offline in sino-logdecode
+//
+// binary log file:
+//   "SINOBLG1"
+//   { u32 record size (type byte included) | u8 type | body }...
+//   SESSION:    i64 realtime ns | u64 steady ns, at the same instant
+//   DESCRIPTOR: u32 id | u8 level | u32 line | str file | str function | str format
+//   EVENT:      u32 id | u64 steady ns | encoded arguments
+//   TEXT:       u64 steady ns | bytes of a pre-formatted line
+// str is u32 length + bytes, descriptor ids are local to a session
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "log_format.h"
+#include "system/time.h"
+
+struct LogSite {
+    uint8_t level;
+    uint32_t line;
+    char const *file;
+    char const *function;
+    // "{}" is replaced by the next argument
+    char const *format;
+};
+
+namespace LOGBIN {
+
+    char constexpr MAGIC[8] = {'S', 'I', 'N', 'O', 'B', 'L', 'G', '1'};
+
+    enum RecordType : uint8_t {
+        SESSION = 1,
+        DESCRIPTOR = 2,
+        EVENT = 3,
+        TEXT = 4,
+    };
+
+    enum ArgType : uint8_t {
+        BOOL = 1,
+        CHAR,
+        INT64,
+        UINT64,
+        DOUBLE,
+        POINTER,
+        STRING,
+        DURATION,
+    };
+
+    // DURATION unit byte
+    enum DurationUnit : uint8_t {
+        NANOSECONDS,
+        MICROSECONDS,
+        MILLISECONDS,
+        SECONDS,
+        MINUTES,
+        HOURS,
+    };
+
+    inline char const *LEVEL_NAME[]{
+            "TRACE",
+            "DEBUG",
+            "INFO ",
+            "WARN ",
+            "ERROR",
+            "FATAL"
+    };
+
+    template<class T>
+    inline void put(char *&p, T value) {
+        std::memcpy(p, &value, sizeof(T));
+        p += sizeof(T);
+    }
+
+    template<class T>
+    inline T get(char const *&p) {
+        T value;
+        std::memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return value;
+    }
+
+    // the same, for bytes that may come from a truncated or corrupt file
+    template<class T>
+    inline T get(char const *&p, char const *end) {
+        if (end - p < static_cast<std::ptrdiff_t>(sizeof(T)))
+            throw std::runtime_error("binary log: truncated record");
+        return get<T>(p);
+    }
+
+    // --- argument encoding, runs on the producer ---
+
+    inline std::string_view asString(char const *s) { return s == nullptr ? "(null)" : s; }
+
+    inline std::string_view asString(std::string const &s) { return s; }
+
+    inline std::string_view asString(std::string_view s) { return s; }
+
+    template<class T>
+    constexpr bool isString() {
+        using U = std::decay_t<T>;
+        return std::is_same_v<U, char const *> || std::is_same_v<U, char *> ||
+               std::is_same_v<U, std::string> || std::is_same_v<U, std::string_view>;
+    }
+
+    template<class T>
+    inline std::size_t argSize(T const &value) {
+        using U = std::decay_t<T>;
+        if constexpr (isString<T>())
+            return 1 + sizeof(uint32_t) + asString(value).size();
+        else if constexpr (std::is_same_v<U, bool> || std::is_same_v<U, char>)
+            return 2;
+        else if constexpr (LOGFMT::isDuration<U>::value)
+            return 1 + 1 + 8;
+        else if constexpr (std::is_arithmetic_v<U> || std::is_pointer_v<U> || std::is_enum_v<U>)
+            return 1 + 8;
+        else
+            static_assert(!sizeof(U *), "argument type can't be logged in binary mode");
+    }
+
+    template<class T>
+    inline void encodeArg(char *&p, T const &value) {
+        using U = std::decay_t<T>;
+        if constexpr (isString<T>()) {
+            auto s = asString(value);
+            put<uint8_t>(p, STRING);
+            put<uint32_t>(p, static_cast<uint32_t>(s.size()));
+            std::memcpy(p, s.data(), s.size());
+            p += s.size();
+        } else if constexpr (std::is_same_v<U, bool>) {
+            put<uint8_t>(p, BOOL);
+            put<uint8_t>(p, value);
+        } else if constexpr (std::is_same_v<U, char>) {
+            put<uint8_t>(p, CHAR);
+            put<char>(p, value);
+        } else if constexpr (LOGFMT::isDuration<U>::value) {
+            using Period = typename U::period;
+            put<uint8_t>(p, DURATION);
+            if constexpr (!std::is_integral_v<typename U::rep> || LOGFMT::unitSuffix<Period>() == nullptr) {
+                put<uint8_t>(p, NANOSECONDS);
+                put<int64_t>(p, std::chrono::duration_cast<std::chrono::nanoseconds>(value).count());
+            } else {
+                uint8_t unit = std::is_same_v<Period, std::nano> ? NANOSECONDS
+                             : std::is_same_v<Period, std::micro> ? MICROSECONDS
+                             : std::is_same_v<Period, std::milli> ? MILLISECONDS
+                             : std::is_same_v<Period, std::ratio<1>> ? SECONDS
+                             : std::is_same_v<Period, std::ratio<60>> ? MINUTES : HOURS;
+                put<uint8_t>(p, unit);
+                put<int64_t>(p, value.count());
+            }
+        } else if constexpr (std::is_floating_point_v<U>) {
+            put<uint8_t>(p, DOUBLE);
+            put<double>(p, value);
+        } else if constexpr (std::is_pointer_v<U>) {
+            put<uint8_t>(p, POINTER);
+            put<uint64_t>(p, reinterpret_cast<uintptr_t>(value));
+        } else if constexpr (std::is_enum_v<U>) {
+            encodeArg(p, static_cast<std::underlying_type_t<U>>(value));
+        } else if constexpr (std::is_signed_v<U>) {
+            put<uint8_t>(p, INT64);
+            put<int64_t>(p, value);
+        } else {
+            put<uint8_t>(p, UINT64);
+            put<uint64_t>(p, value);
+        }
+    }
+
+    template<class... Args>
+    inline std::size_t EncodedSize(Args const &... args) {
+        return sizeof(LogSite const *) + (std::size_t{0} + ... + argSize(args));
+    }
+
+    // ring payload of a binary record: site pointer + encoded arguments
+    template<class... Args>
+    inline void Encode(char *p, LogSite const &site, Args const &... args) {
+        put<LogSite const *>(p, &site);
+        (encodeArg(p, args), ...);
+    }
+
+    // --- formatting, runs on the backend or in the decoder ---
+
+    inline char const *DURATION_SUFFIX[]{"ns", "us", "ms", "s", "min", "h"};
+
+    // false when there are no arguments left
+    inline bool appendArg(std::string &out, char const *&p, char const *end, LOGFMT::Spec const &spec) {
+        if (p >= end)
+            return false;
+        char buf[512];
+        LOGFMT::Writer w(buf, buf + sizeof buf);
+        switch (get<uint8_t>(p, end)) {
+            case BOOL:
+                LOGFMT::WriteBool(w, get<uint8_t>(p, end), spec);
+                break;
+            case CHAR:
+                LOGFMT::WriteValue(w, get<char>(p, end), spec);
+                break;
+            case INT64:
+                LOGFMT::WriteInt(w, get<int64_t>(p, end), spec);
+                break;
+            case UINT64:
+                LOGFMT::WriteInt(w, get<uint64_t>(p, end), spec);
+                break;
+            case DOUBLE:
+                LOGFMT::WriteDouble(w, get<double>(p, end), spec);
+                break;
+            case POINTER:
+                LOGFMT::WritePointer(w, reinterpret_cast<void const *>(get<uint64_t>(p, end)), spec);
+                break;
+            case STRING: {
+                auto len = get<uint32_t>(p, end);
+                std::string_view s(p, std::min<std::size_t>(len, end - p));
+                p += s.size();
+                if (s.size() + spec.width > sizeof buf) {
+                    out.append(s.data(), s.size());
+                    return true;
+                }
+                LOGFMT::WriteString(w, s, spec);
+                break;
+            }
+            case DURATION: {
+                auto unit = get<uint8_t>(p, end);
+                LOGFMT::Spec plain{};
+                LOGFMT::WriteInt(w, get<int64_t>(p, end), plain);
+                w.Append(DURATION_SUFFIX[unit <= HOURS ? unit : static_cast<uint8_t>(NANOSECONDS)]);
+                auto width = w.Cur() - buf;
+                w = LOGFMT::Writer(buf + width, buf + sizeof buf);
+                LOGFMT::WritePadded(w, std::string_view(buf, width), spec, true);
+                out.append(buf + width, w.Cur() - buf - width);
+                return true;
+            }
+            default:
+                // unknown tag, the rest can't be trusted
+                p = end;
+                out += "{?}";
+                return true;
+        }
+        out.append(buf, w.Cur() - buf);
+        return true;
+    }
+
+    // expand format with the encoded arguments, same placeholders as LOGFMT::Format
+    inline void FormatArgs(std::string &out, char const *format, char const *args, char const *end) {
+        char buf[1024];
+        std::string_view fmt(format);
+        // literal text is staged in buf, arguments go straight to out
+        LOGFMT::Writer w(buf, buf + sizeof buf);
+        auto flush = [&] {
+            out.append(buf, w.Cur() - buf);
+            w = LOGFMT::Writer(buf, buf + sizeof buf);
+        };
+        LOGFMT::FormatWith(w, fmt, [&](LOGFMT::Writer &, LOGFMT::Spec const &spec) {
+            flush();
+            return appendArg(out, args, end, spec);
+        });
+        flush();
+    }
+
+    // "2022-03-23 12:00:00.000000 INFO  ", buf needs PREFIX_MAX bytes
+    std::size_t constexpr PREFIX_MAX = 64;
+
+    inline std::size_t FormatPrefix(char *buf, int64_t realtime_ns, uint8_t level) {
+        // the date part is cached per thread and only rebuilt when the second changes
+        auto n = TIME::DateTimeCache::ThisThread().Micros(buf, realtime_ns);
+        buf[n++] = ' ';
+        char const *name = level < 6 ? LEVEL_NAME[level] : "?????";
+        auto len = std::strlen(name);
+        std::memcpy(buf + n, name, len);
+        n += len;
+        buf[n++] = ' ';
+        return n;
+    }
+
+    inline void FormatPrefix(std::string &out, int64_t realtime_ns, uint8_t level) {
+        char buf[PREFIX_MAX];
+        out.append(buf, FormatPrefix(buf, realtime_ns, level));
+    }
+
+    // one complete text line for a binary record
+    inline void FormatLine(std::string &out, int64_t realtime_ns, uint8_t level, char const *format,
+                           std::string_view file, uint32_t line, char const *args, char const *end) {
+        FormatPrefix(out, realtime_ns, level);
+        FormatArgs(out, format, args, end);
+        out += " - ";
+        out.append(file.data(), file.size());
+        out += ':';
+        out += std::to_string(line);
+        out += '\n';
+    }
+
+    // --- binary file writing, runs on the backend ---
+
+    inline void beginRecord(std::string &out, RecordType type, std::size_t body) {
+        out.resize(out.size() + 5);
+        char *p = out.data() + out.size() - 5;
+        put<uint32_t>(p, static_cast<uint32_t>(body + 1));
+        put<uint8_t>(p, type);
+    }
+
+    inline void putString(std::string &out, std::string_view s) {
+        uint32_t len = s.size();
+        out.append(reinterpret_cast<char const *>(&len), sizeof len);
+        out.append(s.data(), s.size());
+    }
+
+    inline void SessionRecord(std::string &out, int64_t realtime_ns, uint64_t steady_ns) {
+        beginRecord(out, SESSION, 16);
+        out.append(reinterpret_cast<char const *>(&realtime_ns), 8);
+        out.append(reinterpret_cast<char const *>(&steady_ns), 8);
+    }
+
+    inline void DescriptorRecord(std::string &out, uint32_t id, LogSite const &site) {
+        std::string_view file(site.file), function(site.function), format(site.format);
+        beginRecord(out, DESCRIPTOR, 4 + 1 + 4 + 12 + file.size() + function.size() + format.size());
+        out.append(reinterpret_cast<char const *>(&id), 4);
+        out += static_cast<char>(site.level);
+        out.append(reinterpret_cast<char const *>(&site.line), 4);
+        putString(out, file);
+        putString(out, function);
+        putString(out, format);
+    }
+
+    inline void EventRecord(std::string &out, uint32_t id, uint64_t steady_ns, char const *args, std::size_t len) {
+        beginRecord(out, EVENT, 4 + 8 + len);
+        out.append(reinterpret_cast<char const *>(&id), 4);
+        out.append(reinterpret_cast<char const *>(&steady_ns), 8);
+        out.append(args, len);
+    }
+
+    inline void TextRecord(std::string &out, uint64_t steady_ns, char const *data, std::size_t len) {
+        beginRecord(out, TEXT, 8 + len);
+        out.append(reinterpret_cast<char const *>(&steady_ns), 8);
+        out.append(data, len);
+    }
+
+    // --- binary file reading ---
+
+    // feed a binary log file chunk by chunk, get text lines back
+    class Decoder {
+    private:
+        struct Descriptor {
+            uint8_t level;
+            uint32_t line;
+            std::string file;
+            std::string function;
+            std::string format;
+        };
+
+        std::string _pending{};
+        std::vector<Descriptor> _descriptors{};
+        int64_t _realtime_base{0};
+        uint64_t _steady_base{0};
+        bool _magic_checked{false};
+
+        // descriptor ids are dense per session, a larger one is corruption
+        static constexpr uint32_t MAX_DESCRIPTORS = 1u << 20;
+
+        static std::string takeString(char const *&p, char const *end) {
+            auto len = get<uint32_t>(p, end);
+            if (end - p < len)
+                throw std::runtime_error("binary log: truncated record");
+            std::string res(p, len);
+            p += len;
+            return res;
+        }
+
+        int64_t toRealtime(uint64_t steady_ns) const {
+            return _realtime_base + static_cast<int64_t>(steady_ns - _steady_base);
+        }
+
+        void decodeRecord(uint8_t type, char const *p, char const *end, std::string &out) {
+            switch (type) {
+                case SESSION:
+                    _realtime_base = get<int64_t>(p, end);
+                    _steady_base = get<uint64_t>(p, end);
+                    _descriptors.clear();
+                    break;
+                case DESCRIPTOR: {
+                    auto id = get<uint32_t>(p, end);
+                    Descriptor d{};
+                    d.level = get<uint8_t>(p, end);
+                    d.line = get<uint32_t>(p, end);
+                    d.file = takeString(p, end);
+                    d.function = takeString(p, end);
+                    d.format = takeString(p, end);
+                    if (id >= MAX_DESCRIPTORS)
+                        throw std::runtime_error("binary log: descriptor id out of range " +
+                                                 std::to_string(id));
+                    if (_descriptors.size() <= id)
+                        _descriptors.resize(id + 1);
+                    _descriptors[id] = std::move(d);
+                    break;
+                }
+                case EVENT: {
+                    auto id = get<uint32_t>(p, end);
+                    auto ts = get<uint64_t>(p, end);
+                    if (id >= _descriptors.size())
+                        throw std::runtime_error("binary log: event refers to unknown descriptor " +
+                                                 std::to_string(id));
+                    auto &d = _descriptors[id];
+                    FormatLine(out, toRealtime(ts), d.level, d.format.c_str(), d.file, d.line, p, end);
+                    break;
+                }
+                case TEXT:
+                    get<uint64_t>(p, end);
+                    out.append(p, end - p);
+                    break;
+                default:
+                    throw std::runtime_error("binary log: unknown record type " + std::to_string(type));
+            }
+        }
+
+    public:
+        // append the text of every complete record in data to out,
+        // an incomplete trailing record is kept for the next call
+        void Feed(char const *data, std::size_t len, std::string &out) {
+            _pending.append(data, len);
+            char const *p = _pending.data();
+            char const *end = p + _pending.size();
+
+            if (!_magic_checked) {
+                if (end - p < static_cast<long>(sizeof MAGIC))
+                    return;
+                if (std::memcmp(p, MAGIC, sizeof MAGIC) != 0)
+                    throw std::runtime_error("binary log: bad magic");
+                p += sizeof MAGIC;
+                _magic_checked = true;
+            }
+
+            while (end - p >= 5) {
+                char const *q = p;
+                auto size = get<uint32_t>(q);
+                if (size == 0)
+                    throw std::runtime_error("binary log: corrupted record");
+                if (end - q < size)
+                    break;
+                auto type = get<uint8_t>(q);
+                decodeRecord(type, q, q + size - 1, out);
+                p = q + size - 1;
+            }
+            _pending.erase(0, p - _pending.data());
+        }
+
+        // true if the file ended on a record boundary
+        bool Complete() const { return _pending.empty(); }
+    };
+}
+
+#endif //LOG_BINARY_H
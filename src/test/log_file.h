@@ -0,0 +1,256 @@
+#ifndef LOG_FILE_H
+#define LOG_FILE_H
+
+// log file sink for the logger backend
+//
+// without rolling, everything goes to path
+// with rolling, segments are named path.000001, path.000002, ...
+// and a new one is started before the first write that would take the
+// current one past rollSize bytes, or the first write after a rollInterval
+// boundary (UTC aligned); the logger decides, see Roll()
+//
+// preallocate: bytes fallocate'd when a segment is opened, so appends don't allocate blocks
+// mmapWindow: copy into a mapped window of the file instead of calling write(),
+//   the file is extended window by window and trimmed to the written size when closed
+
+#include "fs_wrap.h"
+
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <dirent.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <vector>
+
+class LogFile {
+private:
+    std::string _path;
+    std::string _dir;
+    std::string _prefix;
+    std::size_t _roll_size;
+    std::chrono::seconds _roll_interval;
+    std::size_t _keep_segments;
+    std::size_t _preallocate;
+    std::size_t _mmap_window;
+
+    FD _fd{-1};
+    uint64_t _segment{0};
+    // bytes of log data in the current file
+    std::size_t _size{0};
+    // file size reserved in mmap mode
+    std::size_t _allocated{0};
+    time_t _roll_at{0};
+
+    char *_window{nullptr};
+    std::size_t _window_offset{0};
+
+    bool rolling() const {
+        return _roll_size > 0 || _roll_interval.count() > 0;
+    }
+
+    std::string segmentPath(uint64_t segment) const {
+        char suffix[32];
+        snprintf(suffix, sizeof suffix, ".%06llu", static_cast<unsigned long long>(segment));
+        return _path + suffix;
+    }
+
+    // numbers of the segments already on disk, ascending
+    std::vector<uint64_t> listSegments() const {
+        std::vector<uint64_t> res;
+        auto dir = opendir(_dir.c_str());
+        if (dir == nullptr)
+            throw std::runtime_error(strerror(errno));
+        dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            std::string name(entry->d_name);
+            if (name.size() <= _prefix.size() || name.compare(0, _prefix.size(), _prefix) != 0)
+                continue;
+            auto digits = name.substr(_prefix.size());
+            if (digits.find_first_not_of("0123456789") != std::string::npos)
+                continue;
+            res.push_back(std::stoull(digits));
+        }
+        closedir(dir);
+        std::sort(res.begin(), res.end());
+        return res;
+    }
+
+    void unmapWindow() {
+        if (_window != nullptr) {
+            munmap(_window, _mmap_window);
+            _window = nullptr;
+        }
+    }
+
+    // make the file at least end bytes long, prefer real blocks over a sparse tail
+    void reserveFile(std::size_t end) {
+        if (end <= _allocated)
+            return;
+        if (fallocate(_fd.Get(), 0, _allocated, end - _allocated) == -1) {
+            if (errno != EOPNOTSUPP || ftruncate(_fd.Get(), end) == -1)
+                throw std::runtime_error(strerror(errno));
+        }
+        _allocated = end;
+    }
+
+    // map the window holding offset _size
+    void mapWindow() {
+        unmapWindow();
+        _window_offset = _size / _mmap_window * _mmap_window;
+        reserveFile(_window_offset + _mmap_window);
+        void *p = mmap(nullptr, _mmap_window, PROT_WRITE, MAP_SHARED, _fd.Get(), _window_offset);
+        if (p == MAP_FAILED)
+            throw std::runtime_error(strerror(errno));
+        _window = static_cast<char *>(p);
+    }
+
+    void closeFile() {
+        if (_fd.Get() < 0)
+            return;
+        if (_mmap_window > 0) {
+            unmapWindow();
+            // drop the unused tail of the last window
+            if (ftruncate(_fd.Get(), _size) == -1)
+                throw std::runtime_error(strerror(errno));
+        }
+        _fd = FD(-1);
+    }
+
+    void openFile(std::string const &path) {
+        int flags = O_CREAT | O_CLOEXEC | (_mmap_window > 0 ? O_RDWR : O_WRONLY | O_APPEND);
+        _fd = FS::Open(path, flags, 0644);
+        FS::FileState state;
+        state(_fd);
+        _size = state.FileSize();
+        _allocated = _size;
+
+        if (_preallocate > _size) {
+            // keep the size in write mode, O_APPEND must land right after the data
+            int mode = _mmap_window > 0 ? 0 : FALLOC_FL_KEEP_SIZE;
+            if (fallocate(_fd.Get(), mode, _size, _preallocate - _size) == 0 && mode == 0)
+                _allocated = _preallocate;
+        }
+        if (_mmap_window > 0)
+            mapWindow();
+
+        if (_roll_interval.count() > 0) {
+            auto interval = _roll_interval.count();
+            _roll_at = (time(nullptr) / interval + 1) * interval;
+        }
+    }
+
+public:
+    LogFile(std::string const &path, std::size_t rollSize = 0,
+            std::chrono::seconds rollInterval = std::chrono::seconds(0),
+            std::size_t keepSegments = 0, std::size_t preallocate = 0, std::size_t mmapWindow = 0)
+            : _path(path), _roll_size(rollSize), _roll_interval(rollInterval),
+              _keep_segments(keepSegments), _preallocate(preallocate) {
+        auto slash = _path.rfind('/');
+        _dir = slash == std::string::npos ? "." : _path.substr(0, slash + 1);
+        _prefix = (slash == std::string::npos ? _path : _path.substr(slash + 1)) + ".";
+
+        auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        _mmap_window = (mmapWindow + page - 1) / page * page;
+
+        if (rolling()) {
+            // never append to a segment a previous run may have left half written
+            auto segments = listSegments();
+            _segment = segments.empty() ? 1 : segments.back() + 1;
+            openFile(segmentPath(_segment));
+            Cleanup();
+        } else {
+            openFile(_path);
+        }
+    }
+
+    ~LogFile() {
+        try {
+            closeFile();
+        } catch (std::exception const &) {
+        }
+    }
+
+    LogFile(LogFile const &) = delete;
+
+    void operator=(LogFile const &) = delete;
+
+    // bytes of log data in the current file
+    std::size_t Size() const { return _size; }
+
+    // the current segment's rollInterval boundary has passed
+    bool IntervalDue() const {
+        return _roll_interval.count() > 0 && time(nullptr) >= _roll_at;
+    }
+
+    // close the current segment and start the next one
+    void Roll() {
+        if (!rolling())
+            return;
+        closeFile();
+        openFile(segmentPath(++_segment));
+    }
+
+    // remove the oldest segments beyond keepSegments, runs on the logger backend
+    void Cleanup() {
+        if (!rolling() || _keep_segments == 0)
+            return;
+        auto segments = listSegments();
+        if (segments.size() <= _keep_segments)
+            return;
+        for (std::size_t i = 0; i < segments.size() - _keep_segments; i++) {
+            if (segments[i] == _segment)
+                continue;
+            unlink(segmentPath(segments[i]).c_str());
+        }
+    }
+
+    // make every appended byte durable
+    void Sync() {
+        if (_window != nullptr) {
+            std::size_t dirty = _size - _window_offset;
+            if (dirty > 0 && msync(_window, dirty, MS_SYNC) == -1)
+                throw std::runtime_error(strerror(errno));
+        }
+        if (fdatasync(_fd.Get()) == -1)
+            throw std::runtime_error(strerror(errno));
+    }
+
+    void Append(struct iovec *iov, int iovcnt) {
+        if (_mmap_window == 0) {
+            std::size_t total = 0;
+            for (int i = 0; i < iovcnt; i++)
+                total += iov[i].iov_len;
+            FS::WriteV(_fd, iov, iovcnt);
+            _size += total;
+            return;
+        }
+
+        for (int i = 0; i < iovcnt; i++) {
+            auto data = static_cast<char const *>(iov[i].iov_base);
+            std::size_t len = iov[i].iov_len;
+            while (len > 0) {
+                std::size_t pos = _size - _window_offset;
+                if (pos == _mmap_window) {
+                    mapWindow();
+                    pos = 0;
+                }
+                auto n = std::min(len, _mmap_window - pos);
+                std::memcpy(_window + pos, data, n);
+                data += n;
+                len -= n;
+                _size += n;
+            }
+        }
+    }
+
+    void Append(char const *data, std::size_t len) {
+        struct iovec iov{const_cast<char *>(data), len};
+        Append(&iov, 1);
+    }
+};
+
+#endif //LOG_FILE_H
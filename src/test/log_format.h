@@ -0,0 +1,322 @@
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+// allocation free formatting for log lines, every value goes straight into
+// a caller owned char buffer through std::to_chars
+//
+// placeholders: "{}" or "{:spec}", "{{" and "}}" are literal braces
+// spec: [[fill]align][0][width][.precision][type]
+//   align      '<' left, '>' right (default for numbers), '^' center
+//   0          pad numbers with zeros after the sign
+//   type       integers: d x X o b, floats: f e g, pointers: p
+// floats without precision or type print the shortest round-trip form
+// durations print their count and unit: 15ms, 3s, 250ns
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ratio>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace LOGFMT {
+
+    struct Spec {
+        char fill{' '};
+        char align{'\0'};
+        bool zero{false};
+        int width{0};
+        int precision{-1};
+        char type{'\0'};
+    };
+
+    // spec is the text between ':' and '}', false if it is malformed
+    inline bool ParseSpec(std::string_view s, Spec &spec) {
+        std::size_t i = 0;
+        auto isAlign = [](char c) { return c == '<' || c == '>' || c == '^'; };
+        if (s.size() >= 2 && isAlign(s[1])) {
+            spec.fill = s[0];
+            spec.align = s[1];
+            i = 2;
+        } else if (!s.empty() && isAlign(s[0])) {
+            spec.align = s[0];
+            i = 1;
+        }
+        if (i < s.size() && s[i] == '0') {
+            spec.zero = true;
+            i++;
+        }
+        while (i < s.size() && s[i] >= '0' && s[i] <= '9')
+            spec.width = spec.width * 10 + (s[i++] - '0');
+        if (i < s.size() && s[i] == '.') {
+            spec.precision = 0;
+            i++;
+            while (i < s.size() && s[i] >= '0' && s[i] <= '9')
+                spec.precision = spec.precision * 10 + (s[i++] - '0');
+        }
+        if (i < s.size())
+            spec.type = s[i++];
+        return i == s.size();
+    }
+
+    // bounded sink over a char array, output beyond the end is dropped
+    class Writer {
+    private:
+        char *_cur;
+        char *_end;
+
+    public:
+        Writer(char *begin, char *end) : _cur(begin), _end(end) {}
+
+        char *Cur() const { return _cur; }
+
+        std::size_t Avail() const { return _end - _cur; }
+
+        void Append(char const *data, std::size_t len) {
+            len = std::min(len, Avail());
+            std::memcpy(_cur, data, len);
+            _cur += len;
+        }
+
+        void Append(std::string_view s) { Append(s.data(), s.size()); }
+
+        void Put(char c) {
+            if (_cur != _end)
+                *_cur++ = c;
+        }
+
+        void Fill(char c, std::size_t n) {
+            n = std::min(n, Avail());
+            std::memset(_cur, c, n);
+            _cur += n;
+        }
+    };
+
+    // apply width/alignment to an already formatted piece
+    // numeric: right aligned by default, zero padding goes after the sign
+    inline void WritePadded(Writer &w, std::string_view s, Spec const &spec, bool numeric) {
+        std::size_t width = spec.width > 0 ? spec.width : 0;
+        if (s.size() >= width) {
+            w.Append(s);
+            return;
+        }
+        std::size_t pad = width - s.size();
+        if (numeric && spec.zero && spec.align == '\0') {
+            if (!s.empty() && (s[0] == '-' || s[0] == '+')) {
+                w.Put(s[0]);
+                s.remove_prefix(1);
+            }
+            w.Fill('0', pad);
+            w.Append(s);
+            return;
+        }
+        char align = spec.align != '\0' ? spec.align : (numeric ? '>' : '<');
+        std::size_t left = align == '>' ? pad : align == '^' ? pad / 2 : 0;
+        w.Fill(spec.fill, left);
+        w.Append(s);
+        w.Fill(spec.fill, pad - left);
+    }
+
+    inline void WriteString(Writer &w, std::string_view s, Spec const &spec = {}) {
+        if (spec.precision >= 0 && static_cast<std::size_t>(spec.precision) < s.size())
+            s = s.substr(0, spec.precision);
+        WritePadded(w, s, spec, false);
+    }
+
+    template<class Int>
+    inline void WriteInt(Writer &w, Int value, Spec const &spec = {}) {
+        int base = 10;
+        switch (spec.type) {
+            case 'x':
+            case 'X':
+                base = 16;
+                break;
+            case 'o':
+                base = 8;
+                break;
+            case 'b':
+                base = 2;
+                break;
+            default:
+                break;
+        }
+        char buf[72];
+        auto res = std::to_chars(buf, buf + sizeof buf, value, base);
+        if (spec.type == 'X') {
+            for (char *p = buf; p != res.ptr; p++)
+                if (*p >= 'a' && *p <= 'f')
+                    *p -= 'a' - 'A';
+        }
+        if (spec.width == 0) {
+            w.Append(buf, res.ptr - buf);
+            return;
+        }
+        WritePadded(w, std::string_view(buf, res.ptr - buf), spec, true);
+    }
+
+    inline void WriteDouble(Writer &w, double value, Spec const &spec = {}) {
+        char buf[128];
+        std::to_chars_result res{};
+        if (spec.type == '\0' && spec.precision < 0) {
+            res = std::to_chars(buf, buf + sizeof buf, value);
+        } else {
+            auto format = spec.type == 'e' ? std::chars_format::scientific
+                                           : spec.type == 'g' ? std::chars_format::general
+                                                              : std::chars_format::fixed;
+            int precision = spec.precision < 0 ? 6 : spec.precision;
+            res = std::to_chars(buf, buf + sizeof buf, value, format, precision);
+        }
+        if (res.ec != std::errc()) {
+            // a fixed double beyond 128 digits, fall back to scientific
+            res = std::to_chars(buf, buf + sizeof buf, value, std::chars_format::scientific);
+        }
+        WritePadded(w, std::string_view(buf, res.ptr - buf), spec, true);
+    }
+
+    inline void WritePointer(Writer &w, void const *value, Spec const &spec = {}) {
+        char buf[32] = {'0', 'x'};
+        auto res = std::to_chars(buf + 2, buf + sizeof buf, reinterpret_cast<uintptr_t>(value), 16);
+        WritePadded(w, std::string_view(buf, res.ptr - buf), spec, false);
+    }
+
+    inline void WriteBool(Writer &w, bool value, Spec const &spec = {}) {
+        WriteString(w, value ? "true" : "false", spec);
+    }
+
+    template<class Period>
+    constexpr char const *unitSuffix() {
+        if constexpr (std::is_same_v<Period, std::nano>) return "ns";
+        else if constexpr (std::is_same_v<Period, std::micro>) return "us";
+        else if constexpr (std::is_same_v<Period, std::milli>) return "ms";
+        else if constexpr (std::is_same_v<Period, std::ratio<1>>) return "s";
+        else if constexpr (std::is_same_v<Period, std::ratio<60>>) return "min";
+        else if constexpr (std::is_same_v<Period, std::ratio<3600>>) return "h";
+        else return nullptr;
+    }
+
+    template<class Rep, class Period>
+    inline void WriteDuration(Writer &w, std::chrono::duration<Rep, Period> value, Spec const &spec = {}) {
+        char buf[96];
+        Writer tmp(buf, buf + sizeof buf);
+        Spec plain{};
+        plain.precision = spec.precision;
+        plain.type = spec.type == 'f' || spec.type == 'e' || spec.type == 'g' ? spec.type : '\0';
+        if constexpr (unitSuffix<Period>() != nullptr) {
+            if constexpr (std::is_floating_point_v<Rep>)
+                WriteDouble(tmp, value.count(), plain);
+            else
+                WriteInt(tmp, value.count());
+            tmp.Append(unitSuffix<Period>());
+        } else {
+            WriteDouble(tmp, std::chrono::duration<double>(value).count(), plain);
+            tmp.Put('s');
+        }
+        WritePadded(w, std::string_view(buf, tmp.Cur() - buf), spec, true);
+    }
+
+    template<class T>
+    struct isDuration : std::false_type {
+    };
+
+    template<class Rep, class Period>
+    struct isDuration<std::chrono::duration<Rep, Period>> : std::true_type {
+    };
+
+    // pick the writer for a value type
+    template<class T>
+    inline void WriteValue(Writer &w, T const &value, Spec const &spec = {}) {
+        using U = std::decay_t<T>;
+        if constexpr (std::is_same_v<U, bool>) {
+            WriteBool(w, value, spec);
+        } else if constexpr (std::is_same_v<U, char>) {
+            if (spec.type != '\0' && spec.type != 'c')
+                WriteInt(w, static_cast<int>(value), spec);
+            else
+                WritePadded(w, std::string_view(&value, 1), spec, false);
+        } else if constexpr (std::is_integral_v<U>) {
+            WriteInt(w, value, spec);
+        } else if constexpr (std::is_enum_v<U>) {
+            WriteInt(w, static_cast<std::underlying_type_t<U>>(value), spec);
+        } else if constexpr (std::is_floating_point_v<U>) {
+            WriteDouble(w, value, spec);
+        } else if constexpr (std::is_null_pointer_v<U>) {
+            WritePointer(w, nullptr, spec);
+        } else if constexpr (std::is_array_v<T>) {
+            WriteString(w, std::string_view(value), spec);
+        } else if constexpr (std::is_same_v<U, char const *> || std::is_same_v<U, char *>) {
+            WriteString(w, value == nullptr ? "(null)" : value, spec);
+        } else if constexpr (std::is_convertible_v<U const &, std::string_view>) {
+            WriteString(w, std::string_view(value), spec);
+        } else if constexpr (std::is_pointer_v<U>) {
+            WritePointer(w, value, spec);
+        } else if constexpr (isDuration<U>::value) {
+            WriteDuration(w, value, spec);
+        } else {
+            static_assert(!sizeof(U *), "type can't be formatted into a log line");
+        }
+    }
+
+    // type erased argument, lets Format index a parameter pack at run time
+    struct Arg {
+        void (*write)(Writer &, void const *, Spec const &);
+        void const *value;
+    };
+
+    template<class T>
+    inline Arg MakeArg(T const &value) {
+        return Arg{[](Writer &w, void const *v, Spec const &spec) {
+            WriteValue(w, *static_cast<T const *>(v), spec);
+        }, &value};
+    }
+
+    // walk fmt, next(w, spec) writes the next argument and returns false when there is none
+    template<class Next>
+    inline void FormatWith(Writer &w, std::string_view fmt, Next &&next) {
+        std::size_t i = 0;
+        while (i < fmt.size()) {
+            auto brace = fmt.find_first_of("{}", i);
+            if (brace == std::string_view::npos) {
+                w.Append(fmt.substr(i));
+                return;
+            }
+            w.Append(fmt.substr(i, brace - i));
+            i = brace;
+            if (i + 1 < fmt.size() && fmt[i + 1] == fmt[i]) {
+                w.Put(fmt[i]);
+                i += 2;
+                continue;
+            }
+            auto close = fmt[i] == '{' ? fmt.find('}', i) : std::string_view::npos;
+            if (close == std::string_view::npos) {
+                w.Put(fmt[i++]);
+                continue;
+            }
+            Spec spec{};
+            auto inside = fmt.substr(i + 1, close - i - 1);
+            if ((!inside.empty() && (inside[0] != ':' || !ParseSpec(inside.substr(1), spec))) ||
+                !next(w, spec)) {
+                // keep malformed or surplus placeholders visible
+                w.Append(fmt.substr(i, close - i + 1));
+            }
+            i = close + 1;
+        }
+    }
+
+    template<class... Args>
+    inline void Format(Writer &w, std::string_view fmt, Args const &... args) {
+        Arg list[sizeof...(Args) + 1] = {MakeArg(args)...};
+        std::size_t n = 0;
+        FormatWith(w, fmt, [&](Writer &out, Spec const &spec) {
+            if (n == sizeof...(Args))
+                return false;
+            list[n].write(out, list[n].value, spec);
+            n++;
+            return true;
+        });
+    }
+}
+
+#endif //LOG_FORMAT_H
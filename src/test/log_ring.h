@@ -0,0 +1,234 @@
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+
+// bounded single producer single consumer ring of variable-length records
+// producer: the thread owning the ring; consumer: the logger backend
+//
+// layout: [Header][payload ... padded to 16 bytes][Header][payload]...
+// a record never wraps, the tail of the ring is skipped with a PAD record instead
+class LogRing {
+public:
+    struct Header {
+        uint32_t size;      // payload bytes
+        uint32_t kind;
+        uint64_t timestamp;
+    };
+
+    static constexpr uint32_t KIND_PAD = 0xFFFFFFFF;
+    static constexpr std::size_t ALIGN = sizeof(Header);
+
+private:
+    static constexpr std::size_t CACHE_LINE = 64;
+
+    // consumer position, read by producer when its cached copy says full
+    alignas(CACHE_LINE) std::atomic<std::size_t> _head{0};
+    std::size_t _tail_cache{0};
+
+    // producer position, read by consumer when its cached copy says empty
+    alignas(CACHE_LINE) std::atomic<std::size_t> _tail{0};
+    std::size_t _head_cache{0};
+    std::size_t _reserved{0};
+
+    alignas(CACHE_LINE) std::size_t _capacity;
+    std::size_t _mask;
+    std::unique_ptr<char[]> _data;
+
+    static std::size_t roundUp(std::size_t n) {
+        return (n + ALIGN - 1) & ~(ALIGN - 1);
+    }
+
+    Header *headerAt(std::size_t pos) const {
+        return reinterpret_cast<Header *>(_data.get() + (pos & _mask));
+    }
+
+public:
+    // capacity is rounded up to a power of two
+    explicit LogRing(std::size_t capacity) {
+        _capacity = ALIGN * 4;
+        while (_capacity < capacity)
+            _capacity <<= 1;
+        _mask = _capacity - 1;
+        _data.reset(new char[_capacity]);
+    }
+
+    LogRing(LogRing const &) = delete;
+
+    void operator=(LogRing const &) = delete;
+
+    std::size_t Capacity() const { return _capacity; }
+
+    // largest payload a single record may carry
+    std::size_t MaxPayload() const { return _capacity / 2 - sizeof(Header); }
+
+    // bytes currently occupied, approximate when called from the producer
+    std::size_t Used() const {
+        return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+    }
+
+    // producer
+    // return a writable area of len bytes, nullptr if the ring is full
+    char *Reserve(std::size_t len) {
+        if (len > MaxPayload())
+            return nullptr;
+        std::size_t tail = _tail.load(std::memory_order_relaxed);
+        std::size_t need = roundUp(sizeof(Header) + len);
+        std::size_t contiguous = _capacity - (tail & _mask);
+        std::size_t pad = contiguous < need ? contiguous : 0;
+
+        if (tail + pad + need - _head_cache > _capacity) {
+            _head_cache = _head.load(std::memory_order_acquire);
+            if (tail + pad + need - _head_cache > _capacity)
+                return nullptr;
+        }
+        if (pad > 0) {
+            auto h = headerAt(tail);
+            h->size = static_cast<uint32_t>(pad - sizeof(Header));
+            h->kind = KIND_PAD;
+            tail += pad;
+        }
+        _reserved = tail;
+        return reinterpret_cast<char *>(headerAt(tail) + 1);
+    }
+
+    // producer
+    // publish the area returned by the last Reserve(), len <= reserved length
+    void Commit(uint32_t kind, uint64_t timestamp, std::size_t len) {
+        auto h = headerAt(_reserved);
+        h->size = static_cast<uint32_t>(len);
+        h->kind = kind;
+        h->timestamp = timestamp;
+        _tail.store(_reserved + roundUp(sizeof(Header) + len), std::memory_order_release);
+    }
+
+    // producer
+    bool TryPush(uint32_t kind, uint64_t timestamp, char const *data, std::size_t len) {
+        char *p = Reserve(len);
+        if (p == nullptr)
+            return false;
+        std::memcpy(p, data, len);
+        Commit(kind, timestamp, len);
+        return true;
+    }
+
+    // consumer
+    // next record or nullptr if empty, payload follows the header
+    Header const *Front() {
+        std::size_t head = _head.load(std::memory_order_relaxed);
+        while (true) {
+            if (head == _tail_cache) {
+                _tail_cache = _tail.load(std::memory_order_acquire);
+                if (head == _tail_cache)
+                    return nullptr;
+            }
+            auto h = headerAt(head);
+            if (h->kind != KIND_PAD)
+                return h;
+            head += sizeof(Header) + h->size;
+            _head.store(head, std::memory_order_release);
+        }
+    }
+
+    // consumer
+    // drop the record returned by Front()
+    void Pop() {
+        std::size_t head = _head.load(std::memory_order_relaxed);
+        auto h = headerAt(head);
+        _head.store(head + roundUp(sizeof(Header) + h->size), std::memory_order_release);
+    }
+};
+
+// per-thread queue of log records
+// a chain of LogRing, the producer only appends a bigger ring when told to grow,
+// the consumer frees a ring once it is drained and the producer has moved on
+class LogQueue {
+private:
+    struct Node {
+        LogRing ring;
+        std::atomic<Node *> next{nullptr};
+
+        explicit Node(std::size_t capacity) : ring(capacity) {}
+    };
+
+    Node *_producer;
+    Node *_consumer;
+    std::atomic<bool> _retired{false};
+    std::atomic<uint64_t> _dropped{0};
+    uint64_t _dropped_reported{0};
+
+public:
+    explicit LogQueue(std::size_t capacity) : _producer(new Node(capacity)), _consumer(_producer) {}
+
+    ~LogQueue() {
+        while (_consumer != nullptr) {
+            auto next = _consumer->next.load(std::memory_order_acquire);
+            delete _consumer;
+            _consumer = next;
+        }
+    }
+
+    LogQueue(LogQueue const &) = delete;
+
+    void operator=(LogQueue const &) = delete;
+
+    // producer
+    LogRing &ProducerRing() { return _producer->ring; }
+
+    // producer
+    // switch to a ring twice as big (or big enough for len), the old one is left to drain
+    LogRing &Grow(std::size_t len) {
+        std::size_t capacity = _producer->ring.Capacity() * 2;
+        while (capacity / 2 < len + 2 * sizeof(LogRing::Header))
+            capacity *= 2;
+        auto node = new Node(capacity);
+        _producer->next.store(node, std::memory_order_release);
+        _producer = node;
+        return node->ring;
+    }
+
+    // producer
+    void Drop() { _dropped.fetch_add(1, std::memory_order_relaxed); }
+
+    // producer, the owning thread has exited
+    void Retire() { _retired.store(true, std::memory_order_release); }
+
+    // consumer
+    LogRing::Header const *Front() {
+        while (true) {
+            auto h = _consumer->ring.Front();
+            if (h != nullptr)
+                return h;
+            auto next = _consumer->next.load(std::memory_order_acquire);
+            if (next == nullptr)
+                return nullptr;
+            // producer published next after its last commit to this ring, recheck once
+            h = _consumer->ring.Front();
+            if (h != nullptr)
+                return h;
+            delete _consumer;
+            _consumer = next;
+        }
+    }
+
+    // consumer
+    void Pop() { _consumer->ring.Pop(); }
+
+    // consumer
+    bool Retired() const { return _retired.load(std::memory_order_acquire); }
+
+    // consumer, lines dropped since the last call
+    uint64_t TakeDropped() {
+        uint64_t total = _dropped.load(std::memory_order_relaxed);
+        uint64_t res = total - _dropped_reported;
+        _dropped_reported = total;
+        return res;
+    }
+
+    uint64_t Dropped() const { return _dropped.load(std::memory_order_relaxed); }
+};
+
+#endif //LOG_RING_H
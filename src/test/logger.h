@@ -2,84 +2,586 @@
 #define LOGGER_H
 
 #include <string>
-#include <queue>
+#include <vector>
+#include <memory>
+#include <algorithm>
 #include <mutex>
+#include <atomic>
+#include <chrono>
 #include <thread>
+#include <unordered_map>
 #include <condition_variable>
 #include <type_traits>
+#include <string_view>
+#include <climits>
+#include <ctime>
+#include <sys/uio.h>
 #include "fs_wrap.h"
+#include "log_ring.h"
+#include "log_format.h"
+#include "log_binary.h"
+#include "log_file.h"
+#include "system/futex.h"
+#include "system/thread.h"
 
 
 class Logger {
+public:
+    // what a producer does when its ring is full
+    enum class OverflowPolicy : uint8_t {
+        BLOCK, // wait for the backend to make room
+        DROP,  // discard the line, counted and reported by the backend
+        GROW,  // chain a ring twice as big
+    };
+
+    struct Options {
+        std::string logPath{};
+        // backend write buffers
+        std::size_t bufferSize{4 << 20};
+        std::size_t bufferCount{4};
+        // per-thread ring, in bytes
+        std::size_t ringSize{1 << 20};
+        OverflowPolicy overflow{OverflowPolicy::BLOCK};
+        // how long a backend holding unwritten lines sleeps between two sweeps,
+        // with nothing pending it sleeps until the next line is logged
+        std::chrono::microseconds pollInterval{1000};
+        uint8_t logLevel{0};
+        // write LOG_BINARY records undecoded, read the file back with sino-logdecode
+        bool binaryFile{false};
+        // roll to logPath.000001, logPath.000002, ... by size and/or time, 0 disables
+        std::size_t rollSize{0};
+        std::chrono::seconds rollInterval{0};
+        // segments kept on disk, the oldest are removed by the backend, 0 keeps all
+        std::size_t keepSegments{0};
+        // bytes fallocate'd for each new segment
+        std::size_t preallocate{0};
+        // append through a memory-mapped window of this size instead of write(), 0 disables
+        std::size_t mmapWindow{0};
+        // pending lines are written once they reach flushSize bytes (0 means one full write buffer)
+        // or once the oldest of them has waited flushDelay, whichever comes first
+        std::size_t flushSize{0};
+        std::chrono::milliseconds flushDelay{1000};
+        // fdatasync after each write, so one sync covers everything gathered since the last one
+        bool syncOnFlush{false};
+        // stamp records from the calibrated TSC instead of clock_gettime (x86 with invariant TSC only)
+        bool tscClock{false};
+        // name, CPUs and memory node of the backend thread, e.g. keep it off the reactor cores
+        // with cpus = THREAD::CpuSet::Available() - reactorCpus
+        THREAD::Placement backend{"sino-log"};
+    };
+
 private:
     class LogBuffer {
     private:
-        std::queue<std::string> _buffer_main;
-        std::queue<std::string> _buffer_back;
+        // preallocated chunk of formatted log bytes, never grows
+        class FixedBuffer {
+        private:
+            std::unique_ptr<char[]> _data;
+            std::size_t _capacity;
+            std::size_t _size{0};
+
+        public:
+            explicit FixedBuffer(std::size_t capacity)
+                    : _data(new char[capacity]), _capacity(capacity) {}
+
+            // all or nothing, a line is never split between two buffers
+            bool Append(char const *data, std::size_t len) {
+                if (len > Avail())
+                    return false;
+                std::memcpy(_data.get() + _size, data, len);
+                _size += len;
+                return true;
+            }
+
+            char const *Data() const { return _data.get(); }
+
+            std::size_t Size() const { return _size; }
+
+            std::size_t Avail() const { return _capacity - _size; }
+
+            std::size_t Capacity() const { return _capacity; }
+
+            void Reset() { _size = 0; }
+        };
+
+        using BufferPtr = std::unique_ptr<FixedBuffer>;
+        using QueuePtr = std::shared_ptr<LogQueue>;
+
+        // registers the calling thread's queue on first use, retires it on thread exit
+        struct ThreadQueue {
+            LogBuffer *owner;
+            QueuePtr queue;
+
+            ThreadQueue() : owner(nullptr) {}
+
+            ~ThreadQueue() {
+                if (queue != nullptr)
+                    queue->Retire();
+            }
+        };
+
+        static inline thread_local ThreadQueue _thread_queue;
+
+        // LogRing::Header::kind
+        enum RecordKind : uint32_t {
+            RECORD_TEXT,
+            RECORD_BINARY,
+        };
+
+        Options const _options;
+        // guards _queues and the exit flag
         std::mutex _lk_main;
-        std::mutex _lk_back;
-        std::condition_variable _write_cond;
-        std::mutex _write_mutex;
-        std::size_t _flush_limit;
-        FD _log_fd;
+        // producers wake the idle backend without taking _lk_main
+        THREAD::AutoResetEvent _wake;
+        std::vector<QueuePtr> _queues;
+        std::atomic<bool> _backend_idle{false};
+        // idle without a flush deadline, only a producer's Set() wakes it
+        std::atomic<bool> _backend_parked{false};
+        // the backend exited or failed to write, records are dropped from then on
+        std::atomic<bool> _stopped{false};
         bool _signal_to_exit{false};
+        // Flush() barrier, requested is bumped by callers, done by the backend under _lk_main
+        std::condition_variable _flush_cond;
+        std::atomic<uint64_t> _flush_requested{0};
+        uint64_t _flush_done{0};
+
+        // backend only
+        BufferPtr _current;
+        std::vector<BufferPtr> _full;
+        std::vector<BufferPtr> _free;
+        std::vector<QueuePtr> _sweeping;
+        std::string _scratch;
+        // timestamp of the oldest line not written yet, 0 if none
+        uint64_t _pending_since{0};
+        // binaryFile: session local descriptor ids
+        std::unordered_map<LogSite const *, uint32_t> _site_ids;
+        // bytes taken into buffers and not written to the file yet
+        std::size_t _unwritten{0};
+        // file size right after the current segment's header
+        std::size_t _segment_base{0};
+        // rollInterval boundary passed, checked once per sweep
+        bool _interval_due{false};
+        int64_t _realtime_base;
+        uint64_t _steady_base;
+
+        LogFile _log_file;
+        std::thread _persistent;
+
+        // CLOCK_MONOTONIC nanoseconds, from the TSC once it is calibrated
+        static uint64_t now() {
+            return TIME::TscClock::Monotonic();
+        }
+
+        // calibrate before any producer can stamp a record, returns the realtime base
+        static int64_t startClock(Options const &options) {
+            if (options.tscClock)
+                TIME::TscClock::Calibrate();
+            return TIME::RealtimeNs();
+        }
 
+        LogQueue &threadQueue() {
+            auto &tq = _thread_queue;
+            if (tq.owner != this) {
+                if (tq.queue != nullptr)
+                    tq.queue->Retire();
+                tq.queue = std::make_shared<LogQueue>(_options.ringSize);
+                tq.owner = this;
+                std::lock_guard<std::mutex> lk(_lk_main);
+                _queues.push_back(tq.queue);
+            }
+            return *tq.queue;
+        }
+
+        void wakeBackend() {
+            if (_backend_idle.load(std::memory_order_relaxed))
+                _wake.Set();
+        }
+
+        BufferPtr takeFreeBuffer() {
+            if (_free.empty())
+                return std::make_unique<FixedBuffer>(_options.bufferSize);
+            auto buf = std::move(_free.back());
+            _free.pop_back();
+            return buf;
+        }
 
         void swapBuffer() {
-            std::unique_lock<std::mutex> lk(_write_mutex);
-            _write_mutex.lock();
+            _full.push_back(std::move(_current));
+            _current = takeFreeBuffer();
+        }
+
+        void appendLine(char const *data, std::size_t len) {
+            len = std::min(len, _options.bufferSize);
+            if (!_current->Append(data, len)) {
+                swapBuffer();
+                _current->Append(data, len);
+            }
+            _unwritten += len;
+        }
 
-            std::swap(_buffer_main, _buffer_back);
+        // one writev per batch of buffers, then recycle them
+        void writeBatch() {
+            std::vector<struct iovec> iov;
+            iov.reserve(_full.size());
+            for (auto &it: _full) {
+                if (it->Size() == 0)
+                    continue;
+                iov.push_back({const_cast<char *>(it->Data()), it->Size()});
+            }
+            for (std::size_t i = 0; i < iov.size(); i += IOV_MAX) {
+                _log_file.Append(iov.data() + i,
+                                 static_cast<int>(std::min<std::size_t>(IOV_MAX, iov.size() - i)));
+            }
+            _unwritten = 0;
+            for (auto &it: _full) {
+                // a burst may have allocated extra buffers, give them back to the heap
+                if (_free.size() >= _options.bufferCount)
+                    break;
+                it->Reset();
+                _free.push_back(std::move(it));
+            }
+            _full.clear();
+        }
 
-            _write_cond.notify_one();
-            _write_mutex.unlock();
+        int64_t toRealtime(uint64_t steady_ns) const {
+            return _realtime_base + static_cast<int64_t>(steady_ns - _steady_base);
+        }
+
+        void appendText(uint64_t ts, char const *data, std::size_t len) {
+            if (!_options.binaryFile) {
+                rollBefore(len);
+                appendLine(data, len);
+                return;
+            }
+            rollBefore(len + 13);
+            _scratch.clear();
+            LOGBIN::TextRecord(_scratch, ts, data, len);
+            appendLine(_scratch.data(), _scratch.size());
+        }
+
+        // binary records are formatted here, or re-framed as is for a binary file
+        void consume(LogRing::Header const *h) {
+            auto payload = reinterpret_cast<char const *>(h + 1);
+            if (h->kind == RECORD_TEXT) {
+                appendText(h->timestamp, payload, h->size);
+                return;
+            }
+
+            char const *args = payload;
+            auto site = LOGBIN::get<LogSite const *>(args);
+            auto format = [&] {
+                _scratch.clear();
+                if (!_options.binaryFile) {
+                    LOGBIN::FormatLine(_scratch, toRealtime(h->timestamp), site->level, site->format, site->file,
+                                       site->line, args, payload + h->size);
+                    return;
+                }
+                auto it = _site_ids.find(site);
+                if (it == _site_ids.end()) {
+                    it = _site_ids.emplace(site, static_cast<uint32_t>(_site_ids.size())).first;
+                    LOGBIN::DescriptorRecord(_scratch, it->second, *site);
+                }
+                LOGBIN::EventRecord(_scratch, it->second, h->timestamp, args, payload + h->size - args);
+            };
+            format();
+            // a new segment starts without descriptors, the record must be built again
+            if (rollBefore(_scratch.size()) && _options.binaryFile)
+                format();
+            appendLine(_scratch.data(), _scratch.size());
+        }
+
+        // a binary file starts with its own header, descriptors are emitted again per segment
+        void startSegment() {
+            if (!_options.binaryFile)
+                return;
+            std::string header;
+            if (_log_file.Size() == 0)
+                header.assign(LOGBIN::MAGIC, sizeof LOGBIN::MAGIC);
+            LOGBIN::SessionRecord(header, _realtime_base, _steady_base);
+            _log_file.Append(header.data(), header.size());
+            _site_ids.clear();
+        }
+
+        // the segment is switched right before the first line past rollSize or the
+        // rollInterval boundary, so no segment is left empty; true if it rolled
+        bool rollBefore(std::size_t len) {
+            if (_options.rollSize == 0 && !_interval_due)
+                return false;
+            auto size = _log_file.Size() + _unwritten;
+            if (size == _segment_base)
+                return false;
+            if (!_interval_due && size + len <= _options.rollSize)
+                return false;
+            rollFile();
+            return true;
+        }
+
+        bool flushDue(uint64_t ts) const {
+            if (_pending_since == 0)
+                return false;
+            std::size_t limit = _options.flushSize > 0 ? _options.flushSize : _options.bufferSize;
+            return _unwritten >= limit ||
+                   ts - _pending_since >= static_cast<uint64_t>(
+                           std::chrono::duration_cast<std::chrono::nanoseconds>(_options.flushDelay).count());
+        }
+
+        // write every pending line, partially filled buffer included
+        void writePending(bool sync) {
+            if (_current->Size() > 0)
+                swapBuffer();
+            writeBatch();
+            _pending_since = 0;
+            if (sync)
+                _log_file.Sync();
+        }
+
+        // everything formatted so far stays in the old segment
+        void rollFile() {
+            writePending(_options.syncOnFlush);
+            _log_file.Roll();
+            startSegment();
+            _segment_base = _log_file.Size();
+            _interval_due = false;
+            _log_file.Cleanup();
+        }
+
+        // visit every queue once, taking records stamped before the sweep started,
+        // so lines of different threads are ordered sweep by sweep
+        std::size_t sweep() {
+            uint64_t until = now();
+            _interval_due = _log_file.IntervalDue();
+            {
+                std::lock_guard<std::mutex> lk(_lk_main);
+                _sweeping.assign(_queues.begin(), _queues.end());
+            }
+
+            std::size_t taken = 0;
+            bool removed = false;
+            for (auto &q: _sweeping) {
+                LogRing::Header const *h;
+                while ((h = q->Front()) != nullptr && h->timestamp <= until) {
+                    if (_pending_since == 0)
+                        _pending_since = h->timestamp;
+                    consume(h);
+                    q->Pop();
+                    taken++;
+                }
+                if (auto dropped = q->TakeDropped(); dropped > 0) {
+                    auto msg = "[logger] " + std::to_string(dropped) + " lines dropped\n";
+                    appendText(until, msg.data(), msg.size());
+                }
+                if (h == nullptr && q->Retired())
+                    removed = true;
+            }
+
+            if (removed) {
+                std::lock_guard<std::mutex> lk(_lk_main);
+                _queues.erase(std::remove_if(_queues.begin(), _queues.end(), [](QueuePtr const &q) {
+                    return q->Retired() && q->Front() == nullptr;
+                }), _queues.end());
+            }
+            _sweeping.clear();
+            return taken;
         }
 
         void writeDisk() {
-            std::unique_lock<std::mutex> lk(_write_mutex);
             while (true) {
-                _write_mutex.lock();
-                _write_cond.wait(lk);
-                while (!_buffer_back.empty()) {
-                    FS::Write(_log_fd, _buffer_back.front());
-                    _buffer_back.pop();
+                // read before sweeping, the sweep then covers every line logged before the request
+                uint64_t flush = _flush_requested.load(std::memory_order_acquire);
+                auto taken = sweep();
+                uint64_t ts = now();
+                if (flush != _flush_done) {
+                    writePending(true);
+                    {
+                        std::lock_guard<std::mutex> lk(_lk_main);
+                        _flush_done = flush;
+                    }
+                    _flush_cond.notify_all();
+                } else if (flushDue(ts)) {
+                    writePending(_options.syncOnFlush);
                 }
-                _write_mutex.unlock();
-                if (_signal_to_exit) break;
+                if (taken > 0)
+                    continue;
+
+                auto timeout = std::chrono::duration_cast<std::chrono::nanoseconds>(_options.pollInterval);
+                if (_pending_since != 0) {
+                    auto left = std::chrono::nanoseconds(_pending_since - ts) + _options.flushDelay;
+                    timeout = std::max(std::chrono::nanoseconds(0), std::min(timeout, left));
+                }
+
+                {
+                    std::lock_guard<std::mutex> lk(_lk_main);
+                    if (_signal_to_exit)
+                        break;
+                    if (_flush_requested.load(std::memory_order_relaxed) != _flush_done)
+                        continue;
+                }
+                // a Set() since the checks above leaves the event signalled, nothing is lost
+                _backend_idle.store(true, std::memory_order_relaxed);
+                if (_pending_since != 0) {
+                    _wake.WaitFor(timeout);
+                } else {
+                    // pairs with the fence in commit(): a record is either seen here or its
+                    // producer sees the backend parked and wakes it
+                    _backend_parked.store(true, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if (!hasRecords())
+                        _wake.Wait();
+                    _backend_parked.store(false, std::memory_order_relaxed);
+                }
+                _backend_idle.store(false, std::memory_order_relaxed);
             }
+
+            // producers are gone, take everything left
+            sweep();
+            writePending(_options.syncOnFlush);
         }
 
-    public:
+        // a write error stops the backend instead of the process, blocked producers
+        // and Flush() callers are released and later lines are counted as dropped
+        void runBackend() {
+            try {
+                writeDisk();
+            } catch (std::runtime_error const &) {
+            }
+            _stopped.store(true, std::memory_order_relaxed);
+            {
+                std::lock_guard<std::mutex> lk(_lk_main);
+                _flush_done = _flush_requested.load();
+            }
+            _flush_cond.notify_all();
+        }
 
-        template<class T>
-        LogBuffer &operator<<(T &value) {
-            writeBuffer(std::to_string(value));
-            return *this;
+        bool hasRecords() {
+            std::lock_guard<std::mutex> lk(_lk_main);
+            for (auto &q: _queues) {
+                if (q->Front() != nullptr)
+                    return true;
+            }
+            return false;
         }
 
-        LogBuffer &operator<<(std::string &&value) {
-            writeBuffer(std::move(value));
-            return *this;
+        // room for len bytes in the calling thread's ring, nullptr if the line is dropped
+        // ring is updated when the queue grows
+        char *reserve(LogQueue &q, LogRing *&ring, std::size_t len) {
+            if (len > ring->MaxPayload() && _options.overflow != OverflowPolicy::GROW) {
+                q.Drop();
+                return nullptr;
+            }
+            char *p;
+            while ((p = ring->Reserve(len)) == nullptr) {
+                if (_stopped.load(std::memory_order_relaxed)) {
+                    q.Drop();
+                    return nullptr;
+                }
+                switch (_options.overflow) {
+                    case OverflowPolicy::DROP:
+                        q.Drop();
+                        return nullptr;
+                    case OverflowPolicy::GROW:
+                        ring = &q.Grow(len);
+                        break;
+                    case OverflowPolicy::BLOCK:
+                        _wake.Set();
+                        std::this_thread::yield();
+                        break;
+                }
+            }
+            return p;
         }
 
-        void writeBuffer(std::string &&logItem) {
-            std::lock_guard<std::mutex> lk_m(_lk_main);
-            if (_buffer_main.size() >= _flush_limit) {
-                std::lock_guard<std::mutex> lk_b(_lk_back);
-                swapBuffer();
+        void commit(LogRing *ring, RecordKind kind, std::size_t len) {
+            ring->Commit(kind, now(), len);
+            // a parked backend has no deadline to wake up for, a busy one is only
+            // nudged once the ring fills up
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_backend_parked.load(std::memory_order_relaxed))
+                _wake.Set();
+            else if (ring->Used() > ring->Capacity() / 2)
+                wakeBackend();
+        }
+
+    public:
+
+        // lock free, only touches the calling thread's ring
+        // lines longer than half a write buffer or a ring are truncated
+        void writeBuffer(char const *data, std::size_t len) {
+            auto &q = threadQueue();
+            auto ring = &q.ProducerRing();
+            len = std::min(len, _options.bufferSize / 2);
+            if (_options.overflow != OverflowPolicy::GROW)
+                len = std::min(len, ring->MaxPayload());
+            char *p = reserve(q, ring, len);
+            if (p == nullptr)
+                return;
+            std::memcpy(p, data, len);
+            commit(ring, RECORD_TEXT, len);
+        }
+
+        // arguments are encoded straight into the ring, site must outlive the logger
+        template<class... Args>
+        void writeBinary(LogSite const &site, Args const &... args) {
+            auto &q = threadQueue();
+            auto ring = &q.ProducerRing();
+            auto len = LOGBIN::EncodedSize(args...);
+            if (len > _options.bufferSize / 2) {
+                q.Drop();
+                return;
             }
-            _buffer_main.push(std::move(logItem));
+            char *p = reserve(q, ring, len);
+            if (p == nullptr)
+                return;
+            LOGBIN::Encode(p, site, args...);
+            commit(ring, RECORD_BINARY, len);
         }
 
-        LogBuffer(std::string logPath, std::size_t flushLimit)
-                : _log_fd(FS::Open(logPath, O_WRONLY | O_CREAT | O_APPEND)), _flush_limit(flushLimit) {
-            std::thread persistent(&LogBuffer::writeDisk, this);
-            persistent.detach();
+        // block until every line logged before the call is written and fdatasync'ed
+        // waits on the backend, not async-signal-safe
+        void Flush() {
+            std::unique_lock<std::mutex> lk(_lk_main);
+            if (_signal_to_exit || _stopped.load(std::memory_order_relaxed))
+                return;
+            uint64_t ticket = _flush_requested.fetch_add(1, std::memory_order_acq_rel) + 1;
+            _wake.Set();
+            _flush_cond.wait(lk, [this, ticket] { return _flush_done >= ticket; });
+        }
+
+        // lines dropped by living threads, under OverflowPolicy::DROP or once the backend stopped
+        uint64_t Dropped() {
+            std::lock_guard<std::mutex> lk(_lk_main);
+            uint64_t res = 0;
+            for (auto &q: _queues)
+                res += q->Dropped();
+            return res;
+        }
+
+        explicit LogBuffer(Options const &options)
+                : _options(options),
+                  _realtime_base(startClock(options)),
+                  _steady_base(now()),
+                  _log_file(options.logPath, options.rollSize, options.rollInterval, options.keepSegments,
+                            options.preallocate, options.mmapWindow) {
+            startSegment();
+            _segment_base = _log_file.Size();
+            auto count = std::max<std::size_t>(_options.bufferCount, 2);
+            _current = std::make_unique<FixedBuffer>(_options.bufferSize);
+            _full.reserve(count);
+            _free.reserve(count);
+            for (std::size_t i = 1; i < count; i++)
+                _free.push_back(std::make_unique<FixedBuffer>(_options.bufferSize));
+            _persistent = THREAD::Start(_options.backend, [this] { runBackend(); });
+        }
+
+        // write out whatever is left, then stop the backend
+        ~LogBuffer() {
+            {
+                std::lock_guard<std::mutex> lk(_lk_main);
+                _signal_to_exit = true;
+            }
+            _wake.Set();
+            if (_persistent.joinable())
+                _persistent.join();
         }
-//        static LogBuffer &getInstance(std::string logPath = "", std::size_t flushLimit = 128) {
-//            static LogBuffer _instance(logPath, flushLimit);
-//            return _instance;
-//        }
 
         LogBuffer(LogBuffer const &) = delete;
 
@@ -102,28 +604,45 @@ public:
 //        LEVEL_NUM
     };
 
-    static char const *LOGLEVEL[];
+    static inline char const *LOGLEVEL[]{
+            "TRACE",
+            "DEBUG",
+            "INFO ",
+            "WARN ",
+            "ERROR",
+            "FATAL"
+    };
 
+    // read by every LOG_* call, may be changed at run time from any thread
     static inline uint8_t GetLogLevel() {
-        return _log_level;
+        return _log_level.load(std::memory_order_relaxed);
+    }
+
+    static inline void SetLogLevel(uint8_t level) {
+        _log_level.store(level, std::memory_order_relaxed);
     }
 
 private:
-    static uint8_t _log_level;
+    static inline std::atomic<uint8_t> _log_level{0};
     LogBuffer _buffer;
 
-    Logger(std::string logPath, std::size_t flushLimit, uint8_t loglevel)
-            : _buffer(logPath, flushLimit) {
-        _log_level = loglevel;
+    explicit Logger(Options const &options)
+            : _buffer(options) {
+        SetLogLevel(options.logLevel);
     }
 
 public:
 
-    static Logger &getInstance(std::string logPath = "", std::size_t flushLimit = 128, uint8_t loglevel = 0) {
-        static Logger _instance(logPath, flushLimit, loglevel);
+    // options only take effect on the first call
+    static Logger &getInstance(Options const &options) {
+        static Logger _instance(options);
         return _instance;
     }
 
+    static Logger &getInstance() {
+        return getInstance(Options{});
+    }
+
     Logger(Logger const &) = delete;
 
     Logger(Logger &&) = delete;
@@ -131,19 +650,164 @@ public:
     void operator=(Logger const &) = delete;
 
     void operator=(Logger &&) = delete;
-};
 
-uint8_t Logger::_log_level;
-char const *Logger::LOGLEVEL[]{
-        "TRACE",
-        "DEBUG",
-        "INFO ",
-        "WARN ",
-        "ERROR",
-        "FATAL"
+    template<class... Args>
+    void LogBinary(LogSite const &site, Args const &... args) {
+        _buffer.writeBinary(site, args...);
+    }
+
+    // write and sync everything logged so far, for shutdown paths and fatal-error
+    // reporting on a normal thread (e.g. before abort() or std::terminate)
+    // NOT async-signal-safe: it locks a mutex and waits on a condition variable,
+    // so it must not be called from a SIGSEGV/SIGABRT/... handler, where it can
+    // deadlock if the signal hit while that mutex was held
+    void Flush() {
+        _buffer.Flush();
+    }
+
+    // one text line, formatted on the stack with std::to_chars and copied into
+    // the thread's ring when destroyed, no allocation per field
+    // "<time> <level> <message> - <file>:<line>"
+    class LogLine {
+    private:
+        static constexpr std::size_t LINE_MAX_SIZE = 4096;
+        static constexpr std::size_t SUFFIX_RESERVE = 128;
+
+        char _data[LINE_MAX_SIZE];
+        // the message stops short of the suffix reserve
+        LOGFMT::Writer _writer;
+        char const *_file;
+        int _line;
+
+    public:
+        LogLine(char const *file, int line, uint8_t level, char const *)
+                : _writer(_data, _data + LINE_MAX_SIZE - SUFFIX_RESERVE), _file(file), _line(line) {
+            auto n = LOGBIN::FormatPrefix(_data, TIME::RealtimeNs(), level);
+            _writer = LOGFMT::Writer(_data + n, _data + LINE_MAX_SIZE - SUFFIX_RESERVE);
+        }
+
+        ~LogLine() {
+            char const *base = std::strrchr(_file, '/');
+            base = base == nullptr ? _file : base + 1;
+            LOGFMT::Writer suffix(_writer.Cur(), _data + LINE_MAX_SIZE);
+            suffix.Append(" - ");
+            suffix.Append(std::string_view(base).substr(0, SUFFIX_RESERVE - 32));
+            suffix.Put(':');
+            LOGFMT::WriteInt(suffix, _line);
+            suffix.Put('\n');
+            Logger::getInstance()._buffer.writeBuffer(_data, suffix.Cur() - _data);
+        }
+
+        LogLine(LogLine const &) = delete;
+
+        void operator=(LogLine const &) = delete;
+
+        LogLine &stream() { return *this; }
+
+        // integers, floats, bool, char, strings, pointers, std::chrono durations
+        template<class T>
+        LogLine &operator<<(T const &value) {
+            LOGFMT::WriteValue(_writer, value);
+            return *this;
+        }
+
+        // "{}" or "{:spec}" placeholders, see log_format.h
+        template<class... Args>
+        LogLine &Format(std::string_view fmt, Args const &... args) {
+            LOGFMT::Format(_writer, fmt, args...);
+            return *this;
+        }
+    };
+
+    // per call site limiters, each LOG_* macro below owns a static one
+
+    // pass the first n calls
+    class FirstN {
+    private:
+        std::atomic<uint64_t> _count{0};
+
+    public:
+        bool Allow(uint64_t n) {
+            return _count.load(std::memory_order_relaxed) < n &&
+                   _count.fetch_add(1, std::memory_order_relaxed) < n;
+        }
+    };
+
+    // pass one call out of every n, the first one included; n == 0 passes none, like FirstN
+    class EveryN {
+    private:
+        std::atomic<uint64_t> _count{0};
+
+    public:
+        bool Allow(uint64_t n) {
+            return n != 0 && _count.fetch_add(1, std::memory_order_relaxed) % n == 0;
+        }
+    };
+
+    // pass at most n calls per second
+    // once the budget is spent, callers only read the shared cache line
+    class RateLimit {
+    private:
+        std::atomic<int64_t> _second{-1};
+        std::atomic<uint64_t> _count{0};
+
+    public:
+        bool Allow(uint64_t n) {
+            struct timespec ts{};
+            clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+            int64_t second = ts.tv_sec;
+            int64_t current = _second.load(std::memory_order_relaxed);
+            if (current != second && _second.compare_exchange_strong(current, second, std::memory_order_relaxed))
+                _count.store(0, std::memory_order_relaxed);
+            return _count.load(std::memory_order_relaxed) < n &&
+                   _count.fetch_add(1, std::memory_order_relaxed) < n;
+        }
+    };
 };
 
-#define LOG_TRACE if ( Logger::GetLogLevel() <= Logger::TRACE ) \
-    Logger::(__FILE__, __LINE__, Logger::LOGLEVEL[Logger::TRACE], __func__).stream()
+// levels below SINO_LOG_ACTIVE_LEVEL are compiled out, e.g. -DSINO_LOG_ACTIVE_LEVEL=2 keeps INFO and above
+// the remaining levels are still checked against Logger::GetLogLevel() at run time
+#ifndef SINO_LOG_ACTIVE_LEVEL
+#define SINO_LOG_ACTIVE_LEVEL 0
+#endif
+
+// cond is only evaluated when the level is enabled
+#define SINO_LOG_IF(level, cond) \
+    if constexpr ((level) < SINO_LOG_ACTIVE_LEVEL) {} \
+    else if (!(Logger::GetLogLevel() <= (level) && (cond))) {} \
+    else Logger::LogLine(__FILE__, __LINE__, (level), __func__).stream()
+
+// a static limiter of the given type, one per expansion
+#define SINO_LOG_SITE(Limiter) \
+    ([]() -> Logger::Limiter & { static Logger::Limiter _log_limiter; return _log_limiter; }())
+
+#define LOG_TRACE SINO_LOG_IF(Logger::TRACE, true)
+#define LOG_DEBUG SINO_LOG_IF(Logger::DEBUG, true)
+#define LOG_INFO SINO_LOG_IF(Logger::INFO, true)
+#define LOG_WARN SINO_LOG_IF(Logger::WARN, true)
+#define LOG_ERROR SINO_LOG_IF(Logger::ERROR, true)
+#define LOG_FATAL SINO_LOG_IF(Logger::FATAL, true)
+
+// LOG_FORMAT(Logger::INFO, "took {:.3f}ms for {:>8} bytes", ms, n);
+#define LOG_FORMAT(level, format, ...) SINO_LOG_IF(level, true).Format(format, ##__VA_ARGS__)
+
+// LOG_EVERY_N(Logger::WARN, 100) << "..."; logs one call in 100
+#define LOG_EVERY_N(level, n) SINO_LOG_IF(level, SINO_LOG_SITE(EveryN).Allow(n))
+// logs the first n calls only
+#define LOG_FIRST_N(level, n) SINO_LOG_IF(level, SINO_LOG_SITE(FirstN).Allow(n))
+// logs at most n calls per second
+#define LOG_EVERY_SECOND(level, n) SINO_LOG_IF(level, SINO_LOG_SITE(RateLimit).Allow(n))
+
+// format is only parsed on the backend or by sino-logdecode, "{}" takes the next argument
+// arguments: arithmetic types, enums, pointers, char const *, std::string, std::string_view
+#define LOG_BINARY(level, format, ...) \
+    do { \
+        if constexpr ((level) >= SINO_LOG_ACTIVE_LEVEL) { \
+            if (Logger::GetLogLevel() <= (level)) { \
+                static LogSite const _log_site{(level), __LINE__, __FILE__, __func__, (format)}; \
+                Logger::getInstance().LogBinary(_log_site, ##__VA_ARGS__); \
+            } \
+        } \
+    } while (0)
 
 #endif //SIHTTP_LOGGER_H
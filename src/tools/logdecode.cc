@@ -0,0 +1,42 @@
+// sino-logdecode: turn a binary log written with Logger::Options::binaryFile into text
+//
+// usage: sino-logdecode <binary log> [text output]
+// text goes to stdout when no output path is given
+
+#include "test/fs_wrap.h"
+#include "test/log_binary.h"
+
+#include <cstdio>
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s <binary log> [text output]\n", argv[0]);
+        return 2;
+    }
+
+    try {
+        FD in = FS::Open(argv[1], O_RDONLY | O_CLOEXEC);
+        FD out = argc == 3 ? FS::Open(argv[2], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)
+                           : FD(dup(STDOUT_FILENO));
+
+        LOGBIN::Decoder decoder;
+        std::vector<char> buf;
+        std::string text;
+        while (true) {
+            auto n = FS::Read(in, buf, 1 << 20);
+            if (n == 0)
+                break;
+            decoder.Feed(buf.data(), n, text);
+            FS::Write(out, text);
+            text.clear();
+        }
+        if (!decoder.Complete()) {
+            fprintf(stderr, "%s: %s ends with a truncated record\n", argv[0], argv[1]);
+            return 1;
+        }
+    } catch (std::exception const &e) {
+        fprintf(stderr, "%s: %s\n", argv[0], e.what());
+        return 1;
+    }
+    return 0;
+}